@@ -8,8 +8,13 @@
 #include <float.h>
 #include <limits.h>
 
-// for most use cases, float would probably be fine
+// for most use cases, float would probably be fine - define USE_FLOAT_REAL to halve memory used by points, etc.
+//  (nanovg only uses float anyway)
+#ifdef USE_FLOAT_REAL
+typedef float real;
+#else
 typedef double real;
+#endif
 
 #define NaN real(NAN)
 #define REAL_MAX  real(FLT_MAX)
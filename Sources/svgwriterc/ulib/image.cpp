@@ -27,21 +27,19 @@
 #include "image.hxx"
 #include "painter.hxx"
 
-Image::Image(int w, int h, Encoding imgfmt) : Image(w, h, NULL, imgfmt)
-{
-  if(w > 0 && h > 0)
-    data = (unsigned char*)calloc(w*h, 4);
-}
+Image::Image(int w, int h, Encoding imgfmt) : Image(w, h, w > 0 && h > 0 ? (unsigned char*)calloc(w*h, 4) : NULL, imgfmt) {}
 
 Image::Image(Image&& other) : width(std::exchange(other.width, 0)), height(std::exchange(other.height, 0)),
-    data(std::exchange(other.data, nullptr)), encData(std::move(other.encData)),
-    encoding(other.encoding), painterHandle(std::exchange(other.painterHandle, -1)) {}
+    encData(std::move(other.encData)), encoding(other.encoding), painterHandle(std::exchange(other.painterHandle, -1)),
+    data(std::exchange(other.data, nullptr)), stride(std::exchange(other.stride, 0)), buffer(std::move(other.buffer)) {}
 
 Image& Image::operator=(Image&& other)
 {
   std::swap(width, other.width);
   std::swap(height, other.height);
   std::swap(data, other.data);
+  std::swap(stride, other.stride);
+  std::swap(buffer, other.buffer);
   std::swap(encData, other.encData);
   std::swap(encoding, other.encoding);
   std::swap(painterHandle, other.painterHandle);
@@ -50,12 +48,26 @@ Image& Image::operator=(Image&& other)
 
 // we've switched from vector to plain pointer for data since that's what stb_image's load fns return
 // we can't copy painterHandle ... TODO: could use something like clone_ptr here instead
-Image::Image(const Image& other) : width(other.width), height(other.height), data(NULL),
-   encData(other.encData), encoding(other.encoding), painterHandle(-1)
+Image::Image(const Image& other) : width(other.width), height(other.height), encData(other.encData),
+   encoding(other.encoding), painterHandle(-1), data(other.data), stride(other.stride), buffer(other.buffer) {}
+
+void Image::detach(bool unique)
 {
-  int n = width*height*4;
-  data = (unsigned char*)malloc(n);
-  memcpy(data, other.data, n);
+  if(!data || (isContiguous() && (!unique || buffer.use_count() == 1)))
+    return;
+  unsigned char* d = (unsigned char*)malloc(width*height*4);
+  for(int y = 0; y < height; ++y)
+    memcpy(d + y*width*4, data + y*stride, width*4);
+  data = d;
+  stride = width*4;
+  buffer.reset(d, free);
+}
+
+Image Image::contiguous() const
+{
+  Image out(*this);
+  out.detach(false);
+  return out;
 }
 
 Image Image::fromPixels(int w, int h, unsigned char* d, Encoding imgfmt)
@@ -74,13 +86,11 @@ Image Image::fromPixelsNoCopy(int w, int h, unsigned char* d, Encoding imgfmt)
 Image::~Image()
 {
   invalidate();
-  if(data)
-    free(data);
 }
 
 void Image::invalidate()
 {
-  encData.clear();
+  encData.reset();
   Painter::invalidateImage(painterHandle);
   painterHandle = -1;
 }
@@ -116,25 +126,29 @@ Image Image::scaled(int w, int h) const
   return transformed(Transform2D().scale(w/(float)width, h/(float)height));
 }
 
+// no pixels are copied - result is a view with same stride as this image
 Image Image::cropped(const SVGRect& src) const
 {
-  int outw = std::min(int(src.right), width) - int(src.left);
-  int outh = std::min(int(src.bottom), height) - int(src.top);
+  int left = std::max(int(src.left), 0);
+  int top = std::max(int(src.top), 0);
+  int outw = std::min(int(src.right), width) - left;
+  int outh = std::min(int(src.bottom), height) - top;
   if(outw <= 0 || outh <= 0)
     return Image(0, 0);
-  Image out(outw, outh, encoding);
-  const unsigned int* srcpix = constPixels() + int(src.top)*width + int(src.left);
-  unsigned int* dstpix = out.pixels();
-  for(int y = 0; y < out.height; ++y) {
-    for(int x = 0; x < out.width; ++x)
-      dstpix[y*out.width + x] = srcpix[y*width + x];
-  }
+  Image out(*this);
+  out.width = outw;
+  out.height = outh;
+  out.data = data + top*stride + left*4;
+  out.encData.reset();  // encoded data is for entire image
   return out;
 }
 
 void Image::fill(unsigned int color)
 {
   invalidate();
+  // no need to copy pixels that will be overwritten
+  if(buffer.use_count() > 1 || !isContiguous())
+    *this = Image(width, height, encoding);
   unsigned int* px = pixels();
   for(int ii = 0; ii < width*height; ++ii)
     px[ii] = color;
@@ -148,7 +162,7 @@ Image& Image::subtract(const Image& other, int scale, int offset)
   for(int ii = 0; ii < std::min(height, other.height); ++ii) {
     for(int jj = 0; jj < std::min(width, other.width)*4; ++jj) {
       if(jj % 4 != 3) // skip alpha
-        a[ii*width*4 + jj] = scale*((int)a[ii*width*4 + jj] - b[ii*other.width*4 + jj]) + offset;
+        a[ii*width*4 + jj] = scale*((int)a[ii*width*4 + jj] - b[ii*other.stride + jj]) + offset;
         //a[ii*width*4 + jj] = std::min(std::max(scale*((int)a[ii*width*4 + jj] - b[ii*other.width*4 + jj]) + offset, 0), 255);
     }
   }
@@ -159,15 +173,23 @@ bool Image::operator==(const Image& other) const
 {
   if(width != other.width || height != other.height)
     return false;
-  return memcmp(data, other.data, dataLen()) == 0;
+  if(data == other.data && stride == other.stride)
+    return true;
+  for(int y = 0; y < height; ++y) {
+    if(memcmp(data + y*stride, other.data + y*other.stride, width*4) != 0)
+      return false;
+  }
+  return true;
 }
 
 bool Image::hasTransparency() const
 {
-  unsigned int* pixels = (unsigned int*)data;
-  for(int ii = 0; ii < width*height; ++ii) {
-    if((pixels[ii] & 0xFF000000) != 0xFF000000)
-      return true;
+  for(int y = 0; y < height; ++y) {
+    const unsigned int* pixels = (const unsigned int*)(data + y*stride);
+    for(int x = 0; x < width; ++x) {
+      if((pixels[x] & 0xFF000000) != 0xFF000000)
+        return true;
+    }
   }
   return false;
 }
@@ -205,9 +227,20 @@ Image Image::decodeBuffer(const unsigned char* buff, size_t len, Encoding format
 #endif
 }
 
+bool Image::decodeSize(const unsigned char* buff, size_t len, int* w, int* h)
+{
+  if(!buff || len < 16)
+    return false;
+#ifdef USE_STB_IMAGE
+  return stbi_info_from_memory(buff, len, w, h, NULL) != 0;
+#else
+  return false;
+#endif
+}
+
 // encoding
 
-Image::EncodeBuff Image::encode(Encoding fmt) const
+Image::SharedEncodeBuff Image::encode(Encoding fmt) const
 {
   return fmt == JPEG ? encodeJPEG() : encodePNG();
 }
@@ -246,31 +279,33 @@ static void stbi_write_vec(void* context, void* data, int size)
 }
 
 // use of encData: can be used for PNG or JPEG, but PNG never overwrites JPEG
-Image::EncodeBuff Image::encodePNG() const
+Image::SharedEncodeBuff Image::encodePNG() const
 {
   //stbi_write_png_compression_level = quality;
-  if(encData.size() && encData[0] == 0x89)
+  if(encData && encData->size() && (*encData)[0] == 0x89)
     return encData;
-  EncodeBuff vbuff;
-  EncodeBuff& v = encData.empty() ? encData : vbuff;
-  v.reserve(dataLen()/4);  // guess at compressed size
-  // returns 0 on failure ...
-  if(!stbi_write_png_to_func(&stbi_write_vec, &v, width, height, 4, data, width*4))
-    v.clear();
+  auto v = std::make_shared<EncodeBuff>();
+  v->reserve(dataLen()/4);  // guess at compressed size
+  // returns 0 on failure ... PNG writer supports stride, so views don't need to be copied
+  if(!stbi_write_png_to_func(&stbi_write_vec, v.get(), width, height, 4, data, stride))
+    v->clear();
+  if(!encData || encData->empty())
+    encData = v;
   return v;
 }
 
-Image::EncodeBuff Image::encodeJPEG(int quality) const
+Image::SharedEncodeBuff Image::encodeJPEG(int quality) const
 {
-  if(encData.size() && encData[0] != 0xFF)  //encoding != JPEG)
-    encData.clear();
-  if(encData.empty()) {
-    encData.reserve(dataLen()/4);
-    // returns 0 on failure ...
-    if(!stbi_write_jpg_to_func(&stbi_write_vec, &encData, width, height, 4, data, quality))
-      encData.clear();
-  }
-  return encData;  // makes a copy unavoidably
+  if(encData && encData->size() && (*encData)[0] == 0xFF)  //encoding == JPEG
+    return encData;
+  auto v = std::make_shared<EncodeBuff>();
+  v->reserve(dataLen()/4);
+  // returns 0 on failure ... JPEG writer doesn't support stride
+  Image px = contiguous();
+  if(!stbi_write_jpg_to_func(&stbi_write_vec, v.get(), width, height, 4, px.constBytes(), quality))
+    v->clear();
+  encData = v;
+  return v;
 }
 
 // libjpeg, libpng, and base64 code removed 19 Feb 2021
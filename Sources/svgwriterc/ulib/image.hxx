@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <vector>
+#include <memory>
 #include "geom.hxx"
 
 #ifdef __cplusplus
@@ -11,11 +13,12 @@
 class Image {
 public:
   typedef std::vector<unsigned char> EncodeBuff;
+  // encoded data is shared between copies of an image and with callers of encode()
+  typedef std::shared_ptr<const EncodeBuff> SharedEncodeBuff;
 
   int width;
   int height;
-  unsigned char* data;  //std::vector<char> data;
-  mutable EncodeBuff encData;
+  mutable SharedEncodeBuff encData;
   enum Encoding {UNKNOWN=0, PNG=1, JPEG=2} encoding;  // prefered encoding
   mutable int painterHandle;
 
@@ -26,24 +29,29 @@ public:
   Image copy() const { return Image(*this); }
   void invalidate();
 
-  unsigned char* bytes() { return data; }
+  // pixel data is shared between copies and views (from cropped()) until modified - bytes()/pixels() make
+  //  pixels contiguous and unshared, so must be called again to write after image is copied; constBytes() and
+  //  constPixels() are only contiguous if isContiguous() - use contiguous() otherwise
+  unsigned char* bytes() { detach(true); return data; }
   const unsigned char* constBytes() const { return data; }
-  unsigned int* pixels() { return (unsigned int*)data; }
-  const unsigned int* constPixels() const { return (const unsigned int*)data; }
+  unsigned int* pixels() { return (unsigned int*)bytes(); }
+  const unsigned int* constPixels() const { return (const unsigned int*)constBytes(); }
+  bool isContiguous() const { return stride == width*4; }
+  Image contiguous() const;  // returns copy sharing our pixels if contiguous, otherwise w/ pixels packed
   int dataLen() const { return width*height*4; }
   int getWidth() const { return width; }
   int getHeight() const { return height; }
   bool hasTransparency() const;
   Image& subtract(const Image& other, int scale=1, int offset=0);
 
-  EncodeBuff encode(Encoding dflt) const;  // dflt=PNG
-  EncodeBuff encodePNG() const;
-  EncodeBuff encodeJPEG(int quality = 75) const;
+  SharedEncodeBuff encode(Encoding dflt) const;  // dflt=PNG
+  SharedEncodeBuff encodePNG() const;
+  SharedEncodeBuff encodeJPEG(int quality = 75) const;
 
   void fill(unsigned int color);
   Image scaled(int w, int h) const;  // return a scaled version of the image
   Image transformed(const Transform2D& tf) const;
-  Image cropped(const SVGRect& src) const;
+  Image cropped(const SVGRect& src) const;  // returns view sharing our pixels
   bool isNull() const { return !data; }
   bool operator==(const Image& other) const;
   bool operator!=(const Image& other) const { return !operator==(other); }
@@ -59,11 +67,23 @@ public:
   static Image* decodeJPEG(const char* buff, size_t len);
 #endif
   static Image decodeBuffer(const unsigned char* buff, size_t len, Encoding formatHint = UNKNOWN);
+  // get image dimensions from header w/o decoding; returns false if unsupported
+  static bool decodeSize(const unsigned char* buff, size_t len, int* w, int* h);
   static Image fromPixels(int w, int h, unsigned char* d, Encoding imgfmt = UNKNOWN);
   static Image fromPixelsNoCopy(int w, int h, unsigned char* d, Encoding imgfmt = UNKNOWN);
+  // takes ownership of d, which must be allocated with malloc()
   Image(int w, int h, unsigned char* d, Encoding imgfmt, EncodeBuff encdata = EncodeBuff())
-      : width(w), height(h), data(d), encData(encdata), encoding(imgfmt), painterHandle(-1) {}
+      : width(w), height(h), encData(encdata.empty() ? NULL : std::make_shared<const EncodeBuff>(std::move(encdata))),
+        encoding(imgfmt), painterHandle(-1), data(d), stride(w*4), buffer(d, free) {}
+  // pixels are shared, not copied
   Image(const Image& other);
+
+private:
+  unsigned char* data;  // first pixel of view; rows are stride bytes apart
+  int stride;
+  std::shared_ptr<unsigned char> buffer;
+  // make pixels contiguous and, if unique is true, not shared with any other image
+  void detach(bool unique);
 };
 
 #endif
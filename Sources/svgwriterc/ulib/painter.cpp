@@ -106,6 +106,12 @@ void Painter::beginFrame(real pxRatio)
 void Painter::endFrame()
 {
     ASSERT(vgInUse);
+#ifndef NO_PAINTER_SW
+    // nothing is rendered until nvgEndFrame, and target may have been copied since beginFrame, in which case
+    //  bytes() will give us a new, unshared buffer
+    if(targetImage && !glRender)
+        nvgswSetFramebuffer(vg, targetImage->bytes(), targetImage->width, targetImage->height, 0, 8, 16, 24);
+#endif
     // moved from Painter::beginFrame - nanovg does not make any GL calls until endFrame, so neither should we
 #ifdef NO_PAINTER_GL
     nvgEndFrame(vg);
@@ -176,6 +182,28 @@ void Painter::restore()
     nvgRestore(vg);
 }
 
+void Painter::setState(const PainterState& state)
+{
+    SVGRect clip = currState().clipBounds;
+    float* dashes = currState().strokeDashes;
+    currState() = state;
+    currState().clipBounds = clip;
+    currState().strokeDashes = dashes;
+    setFillBrush(state.fillBrush);
+    setStrokeBrush(state.strokeBrush);
+    setStrokeWidth(state.strokeWidth);
+    setDashOffset(state.strokeDashOffset);
+    setMiterLimit(state.strokeMiterLimit);
+    setStrokeCap(state.strokeCap);
+    setStrokeJoin(state.strokeJoin);
+    setFontSize(state.fontPixelSize);
+    setLetterSpacing(state.letterSpacing);
+    resolveFont();
+    setOpacity(state.globalAlpha);
+    setCompOp(state.compOp);
+    setAntiAlias(state.antiAlias);
+}
+
 // transforms
 
 void Painter::setTransform(const Transform2D& tf)
@@ -250,7 +278,12 @@ void Painter::endPath()
 // TODO: can we decouple Painter and Path better?
 void Painter::drawPath(const Path2D& path)
 {
-    nvgFillRule(vg, path.fillRule == Path2D::EvenOddFill ? NVG_EVENODD : NVG_NONZERO);
+    drawPath(path, path.fillRule == Path2D::EvenOddFill);
+}
+
+void Painter::drawPath(const Path2D& path, bool evenOddFill)
+{
+    nvgFillRule(vg, evenOddFill ? NVG_EVENODD : NVG_NONZERO);
     beginPath();
     for(int ii = 0; ii < path.size(); ++ii) {
         if(path.command(ii) == Path2D::MoveTo)
@@ -313,8 +346,12 @@ void Painter::drawImage(const SVGRect& dest, const Image& image, SVGRect src, in
     flags |= sRGB ? NVG_IMAGE_SRGB : 0;
     // help when scaling down images w/ small features? ... just seemed to make things more blurry
     //flags |= NVG_IMAGE_GENERATE_MIPMAPS;
-    if(image.painterHandle < 0)
-        image.painterHandle = nvgCreateImageRGBA(vg, image.width, image.height, flags, image.constBytes());
+    if(image.painterHandle < 0) {
+        // pixels of a view (w/ stride) are packed into a temporary copy, so nanovg must copy them too
+        if(!image.isContiguous())
+            flags &= ~ImageNoCopy;
+        image.painterHandle = nvgCreateImageRGBA(vg, image.width, image.height, flags, image.contiguous().constBytes());
+    }
     if(!src.isValid())
         src = SVGRect::ltwh(0, 0, image.width, image.height);
     real sx = dest.width()/src.width(), sy = dest.height()/src.height();
@@ -404,6 +441,7 @@ bool Painter::setAntiAlias(bool antialias)
 
 void Painter::setCompOp(CompOp op)
 {
+    currState().compOp = op;
     if(op == CompOp_Clear)
         nvgGlobalCompositeBlendFunc(vg, NVG_ZERO, NVG_ZERO);
     else if(op < NOT_SUPPORTED)
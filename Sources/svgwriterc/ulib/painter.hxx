@@ -278,6 +278,8 @@ public:
     void save();
     void restore();
     void reset();
+    // apply all of state except clip and dash array, e.g., to restore a copy of currState()
+    void setState(const PainterState& state);
 
     void beginFrame(real pxRatio = 1.0);
     void endFrame();
@@ -301,6 +303,7 @@ public:
     void beginPath();
     void endPath();
     void drawPath(const Path2D& path);
+    void drawPath(const Path2D& path, bool evenOddFill);  // ignores path.fillRule
     void drawImage(const SVGRect& dest, const Image& image, SVGRect src = SVGRect(), int flags = 0);
     real drawText(real x, real y, const char* start, const char* end = NULL);
     void setTextAlign(TextAlign align);
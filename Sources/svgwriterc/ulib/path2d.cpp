@@ -17,7 +17,7 @@ void Path2D::addPoint(const SVGPoint& p, PathCommand cmd)
     fillCommands();
     commands.push_back(cmd);
   }
-  points.push_back(p);
+  pushPoint(p);
 }
 
 void Path2D::moveTo(const SVGPoint& p)
@@ -142,6 +142,7 @@ void Path2D::connectPath(const Path2D& other)
 {
   // no need to call reserve() - vector::insert() will do it
   points.insert(points.end(), other.points.cbegin(), other.points.cend());
+  arcLengths.clear();
   if(other.empty() || (isSimple() && other.isSimple())) {}
   else if(other.isSimple())
     commands.insert(commands.end(), other.size(), LineTo);
@@ -202,44 +203,73 @@ Path2D Path2D::toReversed() const
   return rev;
 }
 
-// from nvg__tesselateBezier
-static void flattenBezier(Path2D* out, SVGPoint p1, SVGPoint p2, SVGPoint p3, SVGPoint p4, int level = 0)
+// number of line segments needed so that flattened cubic deviates from curve by at most tol (Wang's formula);
+//  this gives exact output size for toFlat() and lets us step uniformly in t w/o recursion
+static int bezierSegments(const SVGPoint& p1, const SVGPoint& p2, const SVGPoint& p3, const SVGPoint& p4, real tol)
 {
-  static constexpr real tessTol = 0.25;
-
-  real x1 = p1.x, y1 = p1.y, x2 = p2.x, y2 = p2.y, x3 = p3.x, y3 = p3.y, x4 = p4.x, y4 = p4.y;
-  real dx = x4 - x1;
-  real dy = y4 - y1;
-  real d2 = std::abs(((x2 - x4) * dy - (y2 - y4) * dx));
-  real d3 = std::abs(((x3 - x4) * dy - (y3 - y4) * dx));
+  static constexpr int maxSegments = 512;  // nvg__tesselateBezier limits recursion to 9 levels
+  real ddx = std::max(std::abs(p1.x - 2*p2.x + p3.x), std::abs(p2.x - 2*p3.x + p4.x));
+  real ddy = std::max(std::abs(p1.y - 2*p2.y + p3.y), std::abs(p2.y - 2*p3.y + p4.y));
+  real n = std::ceil(std::sqrt(real(0.75)*std::sqrt(ddx*ddx + ddy*ddy)/tol));
+  return n < 1 ? 1 : n > maxSegments ? maxSegments : int(n);  // also handles NaN
+}
 
-  if ((d2 + d3)*(d2 + d3) < tessTol * (dx*dx + dy*dy) || level >= 9)
-    out->lineTo(x4, y4); //, type);
-  else {
-    real x12 = (x1+x2)*0.5;
-    real y12 = (y1+y2)*0.5;
-    real x23 = (x2+x3)*0.5;
-    real y23 = (y2+y3)*0.5;
-    real x34 = (x3+x4)*0.5;
-    real y34 = (y3+y4)*0.5;
-    real x123 = (x12+x23)*0.5;
-    real y123 = (y12+y23)*0.5;
-    real x234 = (x23+x34)*0.5;
-    real y234 = (y23+y34)*0.5;
-    real x1234 = (x123+x234)*0.5;
-    real y1234 = (y123+y234)*0.5;
-
-    flattenBezier(out, SVGPoint(x1,y1), SVGPoint(x12,y12), SVGPoint(x123,y123), SVGPoint(x1234,y1234), level+1);
-    flattenBezier(out, SVGPoint(x1234,y1234), SVGPoint(x234,y234), SVGPoint(x34,y34), SVGPoint(x4,y4), level+1);
+// evaluate cubic at n uniformly spaced t values using forward differences; end point is copied exactly
+static void flattenBezier(Path2D* out, const SVGPoint& p1, const SVGPoint& p2, const SVGPoint& p3,
+    const SVGPoint& p4, int n)
+{
+  // B(t) = a*t^3 + b*t^2 + c*t + p1
+  real h = real(1)/n;
+  SVGPoint a = (p4 - p1) + 3*(p2 - p3);
+  SVGPoint b = 3*(p1 - 2*p2 + p3);
+  SVGPoint c = 3*(p2 - p1);
+  SVGPoint d1 = h*h*h*a + h*h*b + h*c;
+  SVGPoint d3 = 6*h*h*h*a;
+  SVGPoint d2 = d3 + 2*h*h*b;
+  SVGPoint pt = p1;
+  for(int ii = 1; ii < n; ++ii) {
+    pt += d1;
+    d1 += d2;
+    d2 += d3;
+    out->lineTo(pt);
   }
+  out->lineTo(p4);
+}
+
+static SVGPoint quadToCubic(const SVGPoint& p0, const SVGPoint& p1)
+{
+  return SVGPoint(p0.x + real(2.0/3.0)*(p1.x - p0.x), p0.y + real(2.0/3.0)*(p1.y - p0.y));
 }
 
-Path2D Path2D::toFlat() const
+// tol is max distance between curve and flattened path
+Path2D Path2D::toFlat(real tol) const
 {
   if(isSimple())
     return *this;
 
+  // first pass to get exact output size
+  size_t npts = 0, nmoves = 0;
+  for(size_t ii = 0; ii < commands.size(); ++ii) {
+    switch(commands[ii]) {
+    case MoveTo: ++nmoves;  // fall through
+    case LineTo: ++npts; break;
+    case QuadTo:
+      npts += bezierSegments(points[ii-1], quadToCubic(points[ii-1], points[ii]),
+          quadToCubic(points[ii+1], points[ii]), points[ii+1], tol);
+      ++ii;
+      break;
+    case CubicTo:
+      npts += bezierSegments(points[ii-1], points[ii], points[ii+1], points[ii+2], tol);
+      ii += 2;
+      break;
+    case ArcTo:
+      ii += 2;
+      break;
+    }
+  }
+
   Path2D flat;
+  flat.reserve(npts, nmoves > 1);
   for(size_t ii = 0; ii < commands.size(); ++ii) {
     switch(commands[ii]) {
     case LineTo:
@@ -251,13 +281,14 @@ Path2D Path2D::toFlat() const
     case QuadTo:
     {
       SVGPoint p0 = points[ii-1], p1 = points[ii], p2 = points[ii+1];
-      flattenBezier(&flat, p0, SVGPoint(p0.x + 2.0/3.0*(p1.x - p0.x), p0.y + 2.0/3.0*(p1.y - p0.y)),
-                    SVGPoint(p2.x + 2.0/3.0*(p1.x - p2.x), p2.y + 2.0/3.0*(p1.y - p2.y)), p2);
+      SVGPoint c1 = quadToCubic(p0, p1), c2 = quadToCubic(p2, p1);
+      flattenBezier(&flat, p0, c1, c2, p2, bezierSegments(p0, c1, c2, p2, tol));
       ++ii;
       break;
     }
     case CubicTo:
-      flattenBezier(&flat, points[ii-1], points[ii], points[ii+1], points[ii+2]);
+      flattenBezier(&flat, points[ii-1], points[ii], points[ii+1], points[ii+2],
+          bezierSegments(points[ii-1], points[ii], points[ii+1], points[ii+2], tol));
       ii += 2;
       break;
     case ArcTo:
@@ -287,29 +318,75 @@ std::vector<Path2D> Path2D::getSubPaths() const
   return result;
 }
 
+// batch kernels: points are contiguous x,y pairs, so these are plain loops w/o dependencies between
+//  iterations (except for the min/max accumulators, which are split in two to shorten dependency chains) that
+//  the compiler can vectorize
+
+static SVGRect pointsBBox(const SVGPoint* pts, size_t n)
+{
+  if(n == 0)
+    return SVGRect();
+  real minx0 = pts[0].x, miny0 = pts[0].y, maxx0 = pts[0].x, maxy0 = pts[0].y;
+  real minx1 = minx0, miny1 = miny0, maxx1 = maxx0, maxy1 = maxy0;
+  size_t ii = 1;
+  for(; ii + 1 < n; ii += 2) {
+    real x0 = pts[ii].x, y0 = pts[ii].y, x1 = pts[ii+1].x, y1 = pts[ii+1].y;
+    minx0 = x0 < minx0 ? x0 : minx0;  maxx0 = x0 > maxx0 ? x0 : maxx0;
+    miny0 = y0 < miny0 ? y0 : miny0;  maxy0 = y0 > maxy0 ? y0 : maxy0;
+    minx1 = x1 < minx1 ? x1 : minx1;  maxx1 = x1 > maxx1 ? x1 : maxx1;
+    miny1 = y1 < miny1 ? y1 : miny1;  maxy1 = y1 > maxy1 ? y1 : maxy1;
+  }
+  if(ii < n) {
+    minx0 = std::min(minx0, pts[ii].x);  maxx0 = std::max(maxx0, pts[ii].x);
+    miny0 = std::min(miny0, pts[ii].y);  maxy0 = std::max(maxy0, pts[ii].y);
+  }
+  return SVGRect::ltrb(std::min(minx0, minx1), std::min(miny0, miny1), std::max(maxx0, maxx1), std::max(maxy0, maxy1));
+}
+
+// dst may equal src
+static void transformPoints(SVGPoint* dst, const SVGPoint* src, size_t n, const Transform2D& tf)
+{
+  // column-major, as in Transform2D::mult()
+  const real m0 = tf.m[0], m1 = tf.m[1], m2 = tf.m[2], m3 = tf.m[3], m4 = tf.m[4], m5 = tf.m[5];
+  for(size_t ii = 0; ii < n; ++ii) {
+    real x = src[ii].x, y = src[ii].y;
+    dst[ii].x = m0*x + m2*y + m4;
+    dst[ii].y = m1*x + m3*y + m5;
+  }
+}
+
 // for now, we will assume container object caches bbox
 SVGRect Path2D::getBBox() const
 {
+  return pointsBBox(points.data(), points.size());
+}
+
+// bounds of transformed points w/o copying path; transform is applied in blocks to a small stack buffer
+SVGRect Path2D::getBBox(const Transform2D& tf) const
+{
+  if(tf.isIdentity())
+    return getBBox();
+  static constexpr size_t BLOCK = 256;
+  SVGPoint buff[BLOCK];
   SVGRect bbox;
-  for(const SVGPoint& p : points)
-    bbox.rectUnion(p);
+  for(size_t ii = 0; ii < points.size(); ii += BLOCK) {
+    size_t n = std::min(BLOCK, points.size() - ii);
+    transformPoints(buff, points.data() + ii, n, tf);
+    bbox.rectUnion(pointsBBox(buff, n));
+  }
   return bbox;
 }
 
 void Path2D::translate(real x, real y)
 {
-  for(SVGPoint& p : points) {
-    p.x += x;
-    p.y += y;
-  }
+  transformPoints(points.data(), points.data(), points.size(), Transform2D(1, 0, 0, 1, x, y));
+  arcLengths.clear();
 }
 
 void Path2D::scale(real sx, real sy)
 {
-  for(SVGPoint& p : points) {
-    p.x *= sx;
-    p.y *= sy;
-  }
+  transformPoints(points.data(), points.data(), points.size(), Transform2D(sx, 0, 0, sy, 0, 0));
+  arcLengths.clear();
 }
 
 // TODO: this doesn't work for arcs!
@@ -318,8 +395,8 @@ void Path2D::scale(real sx, real sy)
 Path2D& Path2D::transform(const Transform2D& tf)
 {
   if(!tf.isIdentity()) {
-    for(SVGPoint& p : points)
-      p = tf.mult(p);
+    transformPoints(points.data(), points.data(), points.size(), tf);
+    arcLengths.clear();
   }
   return *this;
 }
@@ -367,8 +444,27 @@ bool Path2D::isEnclosedBy(const Path2D& lasso) const
   return true;
 }
 
+// every method modifying points clears index
+const std::vector<real>& Path2D::arcLengthIndex() const
+{
+  if(arcLengths.empty() && !points.empty()) {
+    arcLengths.resize(points.size());
+    real dx = 0, dy = 0, length = 0;
+    arcLengths[0] = 0;
+    for(size_t ii = 1; ii < points.size(); ++ii) {
+      dx = points[ii].x - points[ii-1].x;
+      dy = points[ii].y - points[ii-1].y;
+      length += sqrt(dx*dx + dy*dy);
+      arcLengths[ii] = length;
+    }
+  }
+  return arcLengths;
+}
+
 real Path2D::pathLength() const
 {
+  if(!arcLengths.empty())
+    return arcLengths.back();
   real dx = 0, dy = 0, length = 0;
   for(size_t ii = 1; ii < points.size(); ++ii) {
     dx = points[ii].x - points[ii-1].x;
@@ -378,23 +474,48 @@ real Path2D::pathLength() const
   return length;
 }
 
+// position at offset on segment ending at point ii
+SVGPoint Path2D::pointOnSegment(size_t ii, real offset, SVGPoint* normal_out) const
+{
+  real dx = points[ii].x - points[ii-1].x;
+  real dy = points[ii].y - points[ii-1].y;
+  real t = (offset - arcLengths[ii-1])/sqrt(dx*dx + dy*dy);
+  if(normal_out)
+    *normal_out = SVGPoint(-dy, dx).normalize();
+  return t*points[ii]  + (1-t)*points[ii-1];
+}
+
 // note that offset is not normalized - to use a normalized offset, multiply by pathLength()
 SVGPoint Path2D::positionAlongPath(real offset, SVGPoint* normal_out) const
 {
-  real dx = 0, dy = 0, dr = 0, length = 0;
-  for(size_t ii = 1; ii < points.size(); ++ii) {
-    dx = points[ii].x - points[ii-1].x;
-    dy = points[ii].y - points[ii-1].y;
-    dr = sqrt(dx*dx + dy*dy);
-    if(length + dr > offset) {
-      real t = (offset - length)/dr;
-      if(normal_out)
-        *normal_out = SVGPoint(-dy, dx).normalize();
-      return t*points[ii]  + (1-t)*points[ii-1];
-    }
-    length += dr;
+  const std::vector<real>& lengths = arcLengthIndex();
+  if(lengths.size() < 2)
+    return SVGPoint(NaN, NaN);
+  // first segment ending beyond offset (zero length segments are never selected)
+  auto it = std::upper_bound(lengths.begin() + 1, lengths.end(), offset);
+  if(it == lengths.end())
+    return SVGPoint(NaN, NaN);
+  return pointOnSegment(it - lengths.begin(), offset, normal_out);
+}
+
+// sweeps forward through segments instead of searching for each offset
+std::vector<SVGPoint> Path2D::positionsAlongPath(const std::vector<real>& offsets, std::vector<SVGPoint>* normals_out) const
+{
+  const std::vector<real>& lengths = arcLengthIndex();
+  std::vector<SVGPoint> res;
+  res.reserve(offsets.size());
+  if(normals_out)
+    normals_out->resize(offsets.size());
+  size_t ii = 1;
+  for(size_t jj = 0; jj < offsets.size(); ++jj) {
+    while(ii < lengths.size() && lengths[ii] <= offsets[jj])
+      ++ii;
+    if(ii >= lengths.size())
+      res.push_back(SVGPoint(NaN, NaN));
+    else
+      res.push_back(pointOnSegment(ii, offsets[jj], normals_out ? &(*normals_out)[jj] : NULL));
   }
-  return SVGPoint(NaN, NaN);
+  return res;
 }
 
 // note that we assume closed paths are explicitly closed (e.g. with a lineTo to first point)
@@ -421,3 +542,62 @@ SVGPoint PathPointIter::next()
 // auto it = PathPointIter(path, 2); while(it.hasNext()) { point = it.next(); ... }
 // PathPointXXX pp(path, 2);  for(auto it = pp.begin(); it != pp.end(); ++it) { point = *it; ... }
 // for(Point point : PathPointIter(path, 2)) { }
+
+#ifdef PATH2D_PERF
+// build w/ geom.cpp, stringutil impl, and -DPATH2D_PERF; args: <number of points>
+#include <chrono>
+#include <stdio.h>
+
+template<typename F>
+static double bestOf(int reps, F f)
+{
+  double best = 1E9;
+  for(int rep = 0; rep < reps; ++rep) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t n = argc > 1 ? atol(argv[1]) : 1000000;
+  Path2D lines, curves;
+  lines.reserve(n);
+  for(size_t ii = 0; ii < n; ++ii)
+    lines.addPoint((ii*7919) % 10007, (ii*104729) % 10009);
+  curves.moveTo(0, 0);
+  for(size_t ii = 0; ii < n/3; ++ii)
+    curves.cubicTo(ii + 0.3, 20, ii + 0.6, -20, ii + 1, 0);
+  Transform2D tf = Transform2D().rotate(0.3).scale(1.5, 0.7).translate(10, 20);
+
+  SVGRect bbox;
+  double tbbox = bestOf(5, [&](){ bbox = lines.getBBox(); });
+  double ttfbbox = bestOf(5, [&](){ bbox = lines.getBBox(tf); });
+  double ttf = bestOf(5, [&](){ lines.transform(tf); });
+  size_t nflat = 0;
+  double tflat = bestOf(3, [&](){ nflat = curves.toFlat().size(); });
+  printf("%zu points: bbox %.2f ms, transformed bbox %.2f ms, transform %.2f ms; flatten %.2f ms (%zu points)\n",
+      n, tbbox, ttfbbox, ttf, tflat, nflat);
+
+  // textPath layout: one query per glyph
+  Path2D flat = curves.toFlat();
+  real len = flat.pathLength();
+  size_t nglyphs = 10000;
+  SVGPoint pt, normal;
+  double tindex = bestOf(1, [&](){ flat.arcLengthIndex(); });
+  double tquery = bestOf(3, [&](){
+    for(size_t ii = 0; ii < nglyphs; ++ii)
+      pt = flat.positionAlongPath(ii*len/nglyphs, &normal);
+  });
+  std::vector<real> offsets(nglyphs);
+  for(size_t ii = 0; ii < nglyphs; ++ii)
+    offsets[ii] = ii*len/nglyphs;
+  double tbatch = bestOf(3, [&](){ flat.positionsAlongPath(offsets); });
+  printf("%zu glyphs: arc length index %.2f ms, positionAlongPath %.2f ms, positionsAlongPath %.2f ms\n",
+      nglyphs, tindex, tquery, tbatch);
+  return 0;
+}
+#endif
@@ -10,8 +10,6 @@ public:
     // if path parsing fails, last command will be "Error"
     enum PathCommand { MoveTo=1, LineTo, QuadTo, CubicTo, ArcTo }; //, Close, Error};
 
-    std::vector<SVGPoint> points;
-    std::vector<PathCommand> commands;
     enum FillRule { EvenOddFill, WindingFill } fillRule = WindingFill;
     //enum PathType {Path=1, Line, Polyline, Polygon, Rectangle, Ellipse, Circle};
 
@@ -43,23 +41,34 @@ public:
     int size() const { return points.size(); }
     bool empty() const { return points.empty(); }
     bool isClosed() const { return !points.empty() && points.front() == points.back(); }
-    void clear() { points.clear(); commands.clear(); }
-    void resize(size_t n) { points.resize(n);  if(!commands.empty()) commands.resize(n); }
+    void clear() { points.clear(); commands.clear(); arcLengths.clear(); }
+    void resize(size_t n) { points.resize(n);  if(!commands.empty()) commands.resize(n); arcLengths.clear(); }
     SVGRect getBBox() const;
+    SVGRect getBBox(const Transform2D& tf) const;  // bounds of transformed points w/o modifying path
     //bool isNearSVGPoint(Dim x0, Dim y0, Dim radius) const;
     real distToPoint(const SVGPoint& p) const;
     bool isEnclosedBy(const Path2D& lasso) const;
     real pathLength() const;
     SVGPoint positionAlongPath(real offset, SVGPoint* normal_out) const;
+    // offsets must be sorted in ascending order
+    std::vector<SVGPoint> positionsAlongPath(const std::vector<real>& offsets, std::vector<SVGPoint>* normals_out = NULL) const;
+    // cumulative length at each point, built on first use and cleared by every method modifying points; not
+    //  safe to build concurrently from multiple threads
+    const std::vector<real>& arcLengthIndex() const;
 
     void translate(real x, real y);
     void scale(real sx, real sy);
     Path2D& transform(const Transform2D& tf);
 
     Path2D toReversed() const;
-    Path2D toFlat() const;
+    Path2D toFlat(real tol = 0.25) const;
     std::vector<Path2D> getSubPaths() const;
 
+    // direct access for bulk writing (e.g. by path data parser) - clears arc length index, so reference should
+    //  not be held across other calls
+    std::vector<SVGPoint>& editPoints() { arcLengths.clear(); return points; }
+    std::vector<PathCommand>& editCommands() { return commands; }
+
     // reading
     SVGPoint point(int idx) const { return points[idx]; }
     PathCommand command(int idx) const
@@ -81,9 +90,14 @@ public:
     static bool PRESERVE_ARCS;
 
 private:
+    std::vector<SVGPoint> points;
+    std::vector<PathCommand> commands;
+    mutable std::vector<real> arcLengths;
+
     void fillCommands();
-    void pushPoint(const SVGPoint& p) { points.push_back(p); }
+    void pushPoint(const SVGPoint& p) { points.push_back(p); arcLengths.clear(); }
     SVGPoint getEndPoint(int ii) const;
+    SVGPoint pointOnSegment(size_t ii, real offset, SVGPoint* normal_out) const;
 };
 
 // Java-style iterator for iterating over SVGPoints along path, optionally w/ a specified separation dist - in
@@ -2,7 +2,10 @@
 #define STRINGUTIL_H
 
 #include <limits.h>
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
+#include <limits>
 #include <algorithm>
 #include <vector>
 #include <string>
@@ -78,6 +81,24 @@ inline bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <=
 inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
 inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
 
+// FNV-1a hash usable in constant expressions, e.g. switch(constHash(s)) { case constHash("abc"): ... } - duplicate
+//  case labels catch collisions at compile time, but caller must still compare strings for a match
+constexpr uint32_t constHash(const char* s, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for(size_t ii = 0; ii < len; ++ii)
+    h = (h ^ uint8_t(s[ii])) * 16777619u;
+  return h;
+}
+
+constexpr uint32_t constHash(const char* s)
+{
+  uint32_t h = 2166136261u;
+  for(; *s; ++s)
+    h = (h ^ uint8_t(*s)) * 16777619u;
+  return h;
+}
+
 // LLVM StringRef: http://llvm.org/docs/doxygen/html/StringRef_8h_source.html
 class StringRef
 {
@@ -158,6 +179,22 @@ std::vector<StringRef> splitStringRef(const StringRef& strRef, char sep = ' ', b
 const char* findWord(const char* str, const char* word, char sep = ' ');
 inline bool containsWord(const char* str, const char* word, char sep = ' ') { return findWord(str, word, sep) != NULL; }
 std::string addWord(std::string s, std::string w, char sep = ' ');
+// next word of whitespace separated list (e.g. class attribute), advancing p past it; empty at end of list
+inline StringRef nextWord(const char*& p)
+{
+  while(isSpace(*p)) ++p;
+  const char* word = p;
+  while(*p && !isSpace(*p)) ++p;
+  return StringRef(word, size_t(p - word));
+}
+inline bool listContains(const char* list, const StringRef& word)
+{
+  for(StringRef w = nextWord(list); !w.isEmpty(); w = nextWord(list)) {
+    if(w == word)
+      return true;
+  }
+  return false;
+}
 std::string removeWord(std::string s, std::string w, char sep = ' ');
 char* strNstr(const char* s, const char* substr, size_t len);
 std::string urlEncode(const char* s);
@@ -167,6 +204,13 @@ constexpr size_t base64_enclen(size_t len) { return 4 * ((len + 2) / 3); }
 char* base64_encode(const unsigned char* data, size_t len, char* dest);
 std::string base64_encode(const unsigned char* data, size_t len);
 std::vector<unsigned char> base64_decode(const char* data, size_t len);
+// LENIENT skips all invalid chars (as the vector version does), SKIPSPACE skips whitespace only, STRICT
+//  requires exactly RFC 4648 w/ padding
+enum Base64Mode { BASE64_LENIENT, BASE64_SKIPSPACE, BASE64_STRICT };
+#define BASE64_ERROR size_t(-1)
+constexpr size_t base64_declen(size_t len) { return 3 * ((len + 3) / 4); }  // max decoded length
+// decode to dest (which can be data for in-place decoding); returns decoded length or BASE64_ERROR
+size_t base64_decode(const char* data, size_t len, unsigned char* dest, Base64Mode mode = BASE64_LENIENT);
 inline std::string base64_encode(const std::string& str) { return base64_encode((unsigned char*)str.data(), str.size()); }
 inline std::string base64_encode(const std::vector<unsigned char>& str) { return base64_encode(str.data(), str.size()); }
 inline std::vector<unsigned char> base64_decode(const std::string& str) { return base64_decode(str.data(), str.size()); }
@@ -184,11 +228,18 @@ static int indexOfStr(const StringRef& value, const char* const (&strs)[N])
 }
 
 // strToReal and realToStr are templates to support both float and double
-// from http://www.leapsecond.com/tools/fast_atof.c
+// originally from http://www.leapsecond.com/tools/fast_atof.c; now accumulates digits in a 64-bit int and
+//  scales once at the end, which is both faster and exact (correctly rounded) for up to 15 significant
+//  digits and |exponent| <= 22, i.e., pretty much every number seen in SVG
 template<typename Real>
 static Real strToReal(const char *p, char** endptr)
 {
-  Real sign, value;
+  static const double pow10[] = {1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10, 1E11,
+      1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22};
+  static constexpr uint64_t MAX_MANTISSA = 100000000000000000ULL;  // digits beyond 18th are dropped
+  bool negative = false;
+  uint64_t mant = 0;
+  int exp10 = 0;
 
   // Skip leading white space, if any.
   while(isSpace(*p) ) {
@@ -196,9 +247,8 @@ static Real strToReal(const char *p, char** endptr)
   }
 
   // Get sign, if any.
-  sign = 1.0;
   if(*p == '-') {
-    sign = -1.0;
+    negative = true;
     p += 1;
   }
   else if (*p == '+') {
@@ -206,51 +256,64 @@ static Real strToReal(const char *p, char** endptr)
   }
 
   // Get digits before decimal point or exponent, if any.
-  for (value = 0.0; isDigit(*p); p += 1) {
-    value = value * 10.0 + (*p - '0');
+  for (; isDigit(*p); p += 1) {
+    if(mant < MAX_MANTISSA)
+      mant = mant * 10 + (*p - '0');
+    else
+      ++exp10;
   }
 
   // Get digits after decimal point, if any.
   if(*p == '.') {
-    Real pow10 = 0.1;
     p += 1;
-    while (isDigit(*p)) {
-      value += (*p - '0') * pow10;
-      pow10 *= 0.1;
-      p += 1;
+    for (; isDigit(*p); p += 1) {
+      if(mant < MAX_MANTISSA) {
+        mant = mant * 10 + (*p - '0');
+        --exp10;
+      }
     }
   }
 
   // Handle exponent, if any.
   if((*p == 'e') || (*p == 'E')) {
-    int frac = 0;
-    Real scale = 1.0;
-    unsigned int expon;
+    bool negexp = false;
+    int expon = 0;
     // Get sign of exponent, if any.
     p += 1;
     if(*p == '-') {
-      frac = 1;
+      negexp = true;
       p += 1;
     }
     else if(*p == '+') {
       p += 1;
     }
     // Get digits of exponent, if any.
-    for(expon = 0; isDigit(*p); p += 1) {
-      expon = expon * 10 + (*p - '0');
+    for(; isDigit(*p); p += 1) {
+      if(expon < 10000)
+        expon = expon * 10 + (*p - '0');
     }
-    if (expon > 308) expon = 308;
-    // Calculate scaling factor.
-    while(expon >= 50) { scale *= 1E50; expon -= 50; }
-    while(expon >=  8) { scale *= 1E8;  expon -=  8; }
-    while(expon >   0) { scale *= 10.0; expon -=  1; }
-    value = frac ? (value / scale) : (value * scale);
+    // clamp exponent as original version did so that, e.g., 1e400 gives 1e308 instead of inf
+    if(expon > 308)
+      expon = 308;
+    exp10 += negexp ? -expon : expon;
   }
 
   if(endptr)
     *endptr = (char*)p;
+
+  double value = double(mant);
+  if(mant != 0 && exp10 != 0) {
+    if(exp10 >= -22 && exp10 <= 22)
+      value = exp10 < 0 ? value / pow10[-exp10] : value * pow10[exp10];
+    else {
+      // slow path - split into steps to avoid premature overflow/underflow
+      while(exp10 > 22 && value < 1E300) { value *= 1E22; exp10 -= 22; }
+      while(exp10 < -22 && value > 1E-300) { value /= 1E22; exp10 += 22; }
+      value = exp10 > 22 ? INFINITY : exp10 < -22 ? 0 : exp10 < 0 ? value / pow10[-exp10] : value * pow10[exp10];
+    }
+  }
   // Return signed and scaled floating point result.
-  return sign * value;  // this is actually faster than (negative ? -value : value)
+  return Real(negative ? -value : value);
 }
 
 // We should probably have intToStr and realToStr add '\0' terminators
@@ -273,48 +336,76 @@ int intToStr(char* str, Int x)
   return ii;
 }
 
+// shortest digit string that parses back to exactly x (Grisu2); mantdigits is 53 for double, 24 for float;
+//  returns length, no '\0' terminator
+int realToShortestStr(char* str, double x, int mantdigits = 53);
+
+// prec < 0 requests the shortest string that round trips exactly, otherwise at most prec fractional digits
+//  are written (trailing zeros stripped)
 template<typename Real>
 int realToStr(char* str, Real f, int prec)
 {
-  static const Real powers_of_10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
-
-  // we could of course extend range and precision we handle by using 64-bit ints
-  if(!(f < INT_MAX && f > -INT_MAX && prec < 10))  // handles NaN, since all comparisons with NaN return false
-    return stbsp_sprintf(str, "%.*f", prec, f);  // let the professionals handle this one
+  static const double powers_of_10[] = {1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8,
+      1E9, 1E10, 1E11, 1E12, 1E13, 1E14, 1E15};
+
+  if(prec < 0)
+    return realToShortestStr(str, double(f), std::numeric_limits<Real>::digits);
+  // converting float to double exposes noise digits (e.g. 0.1f = 0.100000001), so use shortest round trip string
+  //  for float if it doesn't exceed requested precision
+  if(std::numeric_limits<Real>::digits < std::numeric_limits<double>::digits) {
+    int len = realToShortestStr(str, double(f), std::numeric_limits<Real>::digits);
+    const char* dot = (const char*)memchr(str, '.', len);
+    if(!memchr(str, 'e', len) && (!dot || str + len - dot - 1 <= prec))
+      return len;
+  }
+  // f - whole is exact, so only the scaled fraction gets rounded; 64-bit whole part covers |f| < 1E18
+  if(!(f < Real(1E18) && f > Real(-1E18) && prec <= 15))  // handles NaN, since all comparisons with NaN return false
+    return stbsp_sprintf(str, "%.*f", prec, double(f));  // let the professionals handle this one
 
   bool negative = f < 0;
-  if(negative)
-    f = -f;
-  // separate integer and decimal part; scale and round decimal part based on requested precision
-  int whole = int(f);
-  int frac = int((f - whole) * powers_of_10[prec] + Real(0.5));
-  int ii = 0;
+  double d = negative ? -double(f) : double(f);
+  uint64_t whole = uint64_t(d);
+  uint64_t frac = uint64_t((d - double(whole)) * powers_of_10[prec] + 0.5);
+  if(frac >= uint64_t(powers_of_10[prec])) {  // this is needed for, e.g., 1.9999999999999
+    whole += 1;
+    frac = 0;
+  }
+  if(frac == 0 && whole == 0) {
+    str[0] = '0';  // main reason for this is to prevent "-0"
+    return 1;
+  }
+  // write digits backwards into a scratch buffer, then copy - avoids std::reverse
+  char buff[48];
+  char* end = buff + sizeof(buff);
+  char* p = end;
   if(frac != 0) {
-    // skip trailing zeros; separate while()s appears to be faster for random numbers
-    while(prec > 0 && frac % 10 == 0) { frac /= 10; --prec; }
-    while(ii < prec) {
-      str[ii++] = '0' + char(frac % 10);
+    // skip trailing zeros
+    while(frac % 10 == 0) { frac /= 10; --prec; }
+    for(; prec > 0; --prec) {
+      *--p = '0' + char(frac % 10);
       frac /= 10;
     }
-    if(ii > 0)
-      str[ii++] = '.';
+    *--p = '.';
   }
-  else if(whole == 0) {
-    str[ii] = '0';  // main reason for this is to prevent "-0"
-    return 1;
-  }
-  if(frac >= 1)  // this is needed for, e.g., 1.9999999999999
-    whole += 1;
   // print at least one digit before decimal
   do {
-    str[ii++] = '0' + char(whole % 10);
+    *--p = '0' + char(whole % 10);
     whole /= 10;
   } while(whole > 0);
-  // print minus sign if negative
   if(negative)
-    str[ii++] = '-';
-  std::reverse(str, str+ii);
-  return ii;
+    *--p = '-';
+  int len = int(end - p);
+  memcpy(str, p, len);
+  return len;
+}
+
+// point pairs are the bulk of path data, so provide a helper to write "x<sep>y"
+template<typename Real>
+int realPairToStr(char* str, Real x, Real y, int prec, char sep = ' ')
+{
+  int ii = realToStr(str, x, prec);
+  str[ii++] = sep;
+  return ii + realToStr(str + ii, y, prec);
 }
 
 #define UTF8_ACCEPT 0
@@ -336,6 +427,7 @@ std::string randomStr(const unsigned int len);
 #define STB_SPRINTF_NOUNALIGNED
 #define STB_SPRINTF_IMPLEMENTATION
 #include "stb_sprintf.h"
+#include <cmath>
 
 static char* stb_sprintfcb(const char* buf, void* user, int len)
 {
@@ -527,40 +619,292 @@ std::string base64_encode(const unsigned char* data, size_t len)
   return outstr;
 }
 
-std::vector<unsigned char> base64_decode(const char* data, size_t len)
+// Decoding uses a separate table for each of the 4 chars in a group holding the value already shifted into
+//  position, so a group of 4 valid chars is just 4 lookups ORed together; any invalid char (incl. padding and
+//  whitespace) sets a high bit and sends us to the slow path.  This is the approach of modp_b64 and Chromium
+//  and is ~4x faster than the bit-at-a-time loop previously used here.  SIMD decoding (SSSE3/NEON) could be
+//  faster still, but inline images are small compared to the cost of decoding the image itself
+#define BASE64_INVALID 0x01000000
+
+struct Base64DecTables
 {
-  static std::vector<int> base64dec(256, -1);
-  if(base64dec['A'] == -1) { for (int ii = 0; ii < 64; ++ii) base64dec[base64enc[ii]] = ii; }
+  uint32_t d0[256], d1[256], d2[256], d3[256];
+  Base64DecTables()
+  {
+    for(int ii = 0; ii < 256; ++ii)
+      d0[ii] = d1[ii] = d2[ii] = d3[ii] = BASE64_INVALID;
+    for(uint32_t ii = 0; ii < 64; ++ii) {
+      unsigned char c = base64enc[ii];
+      d0[c] = ii << 18;  d1[c] = ii << 12;  d2[c] = ii << 6;  d3[c] = ii;
+    }
+  }
+};
 
-  std::vector<unsigned char> strout(((len + 2)/4)*3, '\0');
-  unsigned char* out = &strout[0];
-  unsigned int val = 0;
-  int valb = -8;
-  for (size_t ii = 0; ii < len; ++ii) {
-    char c = data[ii];
-    int d = base64dec[c];
-    if (d == -1) continue;  // skip invalid chars
-    val = (val << 6) + (unsigned int)d;
-    valb += 6;
-    if (valb >= 0) {
-      *out++ = (val >> valb) & 0xFF;
-      valb -= 8;
+size_t base64_decode(const char* data, size_t len, unsigned char* dest, Base64Mode mode)
+{
+  static const Base64DecTables t;
+  const unsigned char* in = (const unsigned char*)data;
+  const unsigned char* end = in + len;
+  unsigned char* out = dest;
+  uint32_t quad = 0;
+  int nq = 0;
+  size_t npad = 0;
+  for(;;) {
+    // fast path - since we read 4 chars before writing 3 bytes, dest == data is OK
+    if(nq == 0) {
+      while(end - in >= 4) {
+        uint32_t x = t.d0[in[0]] | t.d1[in[1]] | t.d2[in[2]] | t.d3[in[3]];
+        if(x & BASE64_INVALID)
+          break;
+        out[0] = (unsigned char)(x >> 16);  out[1] = (unsigned char)(x >> 8);  out[2] = (unsigned char)x;
+        in += 4;
+        out += 3;
+      }
+    }
+    if(in == end)
+      break;
+    unsigned char c = *in++;
+    uint32_t v = t.d3[c];
+    if(v & BASE64_INVALID) {
+      if(c == '=') {
+        // padding - only whitespace and more padding can follow
+        for(npad = 1; in != end; ++in) {
+          if(*in == '=') ++npad;
+          else if(mode == BASE64_STRICT || (mode == BASE64_SKIPSPACE && !isSpace(*in))) return BASE64_ERROR;
+        }
+        break;
+      }
+      if(mode == BASE64_STRICT || (mode == BASE64_SKIPSPACE && !isSpace(c)))
+        return BASE64_ERROR;
+      continue;
     }
+    quad = (quad << 6) | v;
+    if(++nq == 4) {
+      out[0] = (unsigned char)(quad >> 16);  out[1] = (unsigned char)(quad >> 8);  out[2] = (unsigned char)quad;
+      out += 3;
+      quad = 0;
+      nq = 0;
+    }
+  }
+  // final partial group
+  if(mode == BASE64_STRICT && (nq == 1 || (nq > 0 && nq + npad != 4) || (nq == 0 && npad > 0)))
+    return BASE64_ERROR;
+  if(nq == 2)
+    *out++ = (unsigned char)(quad >> 4);
+  else if(nq == 3) {
+    *out++ = (unsigned char)(quad >> 10);
+    *out++ = (unsigned char)(quad >> 2);
   }
-  //ASSERT(out - &strout[0] <= strout.size());
-  strout.resize(out - &strout[0]);
+  return out - dest;
+}
+
+std::vector<unsigned char> base64_decode(const char* data, size_t len)
+{
+  std::vector<unsigned char> strout(base64_declen(len));
+  strout.resize(base64_decode(data, len, strout.data(), BASE64_LENIENT));
   return strout;
 }
 
+// Grisu2 shortest float -> string, adapted from github.com/miloyip/dtoa-benchmark (dtoa_milo.h, MIT license)
+// - instead of reading the IEEE bits, value is split w/ frexp so same code handles float and double (the
+//  boundaries used to pick the shortest digits depend on mantissa width); subnormals just get narrower
+//  boundaries than necessary, so at worst an extra digit
+struct DiyFp
+{
+  uint64_t f;
+  int e;
+
+  DiyFp(uint64_t _f, int _e) : f(_f), e(_e) {}
+  DiyFp operator-(const DiyFp& rhs) const { return DiyFp(f - rhs.f, e); }
+  DiyFp operator*(const DiyFp& rhs) const
+  {
+    const uint64_t M32 = 0xFFFFFFFF;
+    const uint64_t a = f >> 32, b = f & M32, c = rhs.f >> 32, d = rhs.f & M32;
+    const uint64_t ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += uint64_t(1) << 31;  // round
+    return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+  }
+};
+
+// 10^-348, 10^-340, ..., 10^340 normalized to 64-bit significand
+static DiyFp grisuCachedPower(int e, int* K)
+{
+  static const uint64_t cachedPowersF[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+    0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+    0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+    0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+    0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+    0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+    0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+    0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+    0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+    0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+    0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+    0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+    0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+    0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+    0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b,
+  };
+  static const int16_t cachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+  };
+  double dk = (-61 - e) * 0.30102999566398114 + 347;  // dk must be positive, so can do ceiling in positive
+  int k = int(dk);
+  if(dk - k > 0.0) ++k;
+  unsigned index = unsigned((k >> 3) + 1);
+  *K = -(-348 + int(index << 3));  // decimal exponent no need lookup table
+  return DiyFp(cachedPowersF[index], cachedPowersE[index]);
+}
+
+static void grisuRound(char* buff, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+  while(rest < wp_w && delta - rest >= ten_kappa &&
+      (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buff[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static void grisuDigitGen(const DiyFp& W, const DiyFp& Mp, uint64_t delta, char* buff, int* len, int* K)
+{
+  static const uint64_t pow10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+      10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+      10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+      100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL };
+  const DiyFp one(uint64_t(1) << -Mp.e, Mp.e);
+  const DiyFp wp_w = Mp - W;
+  uint32_t p1 = uint32_t(Mp.f >> -one.e);
+  uint64_t p2 = Mp.f & (one.f - 1);
+  int kappa = 1;
+  while(kappa < 10 && p1 >= pow10[kappa]) ++kappa;
+  *len = 0;
+  while(kappa > 0) {
+    uint32_t div = uint32_t(pow10[kappa - 1]);
+    uint32_t d = p1/div;
+    p1 %= div;
+    if(d || *len)
+      buff[(*len)++] = char('0' + d);
+    --kappa;
+    uint64_t tmp = (uint64_t(p1) << -one.e) + p2;
+    if(tmp <= delta) {
+      *K += kappa;
+      grisuRound(buff, *len, delta, tmp, pow10[kappa] << -one.e, wp_w.f);
+      return;
+    }
+  }
+  // kappa = 0
+  for(;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = char(p2 >> -one.e);
+    if(d || *len)
+      buff[(*len)++] = char('0' + d);
+    p2 &= one.f - 1;
+    --kappa;
+    if(p2 < delta) {
+      *K += kappa;
+      int index = -kappa;
+      grisuRound(buff, *len, delta, p2, one.f, wp_w.f * (index < 20 ? pow10[index] : 0));
+      return;
+    }
+  }
+}
+
+int realToShortestStr(char* str, double x, int mantdigits)
+{
+  if(!std::isfinite(x))
+    return stbsp_sprintf(str, "%f", x);
+  int ii = 0;
+  if(x < 0) {
+    str[ii++] = '-';
+    x = -x;
+  }
+  if(x == 0) {
+    str[0] = '0';  // no "-0"
+    return 1;
+  }
+
+  // x = f * 2^e with f having exactly mantdigits bits
+  int e;
+  const int P = mantdigits;
+  uint64_t f = uint64_t(std::ldexp(std::frexp(x, &e), P));
+  e -= P;
+  // boundaries m+ and m- (halfway to neighbors), normalized to the same exponent as m+
+  DiyFp wp(((f << 1) + 1) << (63 - P), e - 1 - (63 - P));
+  DiyFp wm = f == (uint64_t(1) << (P - 1)) ? DiyFp(((f << 2) - 1) << (62 - P), wp.e)
+      : DiyFp(((f << 1) - 1) << (63 - P), wp.e);
+  DiyFp w(f << (64 - P), e - (64 - P));
+
+  int K;
+  const DiyFp c_mk = grisuCachedPower(wp.e, &K);
+  const DiyFp W = w * c_mk;
+  DiyFp Wp = wp * c_mk;
+  DiyFp Wm = wm * c_mk;
+  Wm.f++;
+  Wp.f--;
+  char digits[24];
+  int len;
+  grisuDigitGen(W, Wp, Wp.f - Wm.f, digits, &len, &K);
+
+  // digits * 10^K; decimal point goes after kk digits.  Use plain notation unless exponential is shorter
+  int kk = len + K;
+  int exp10 = kk - 1;
+  int explen = len + (len > 1 ? 1 : 0) + 2 + (exp10 < 0 ? 1 : 0) + (std::abs(exp10) >= 100 ? 2 : std::abs(exp10) >= 10);
+  char* s = str + ii;
+  if(K >= 0 && kk <= explen) {
+    memcpy(s, digits, len);  // integer
+    memset(s + len, '0', K);
+    return ii + kk;
+  }
+  if(kk > 0 && K < 0) {
+    memcpy(s, digits, kk);
+    s[kk] = '.';
+    memcpy(s + kk + 1, digits + kk, len - kk);
+    return ii + len + 1;
+  }
+  if(kk <= 0 && 2 - kk + len <= explen) {
+    s[0] = '0';  s[1] = '.';
+    memset(s + 2, '0', -kk);
+    memcpy(s + 2 - kk, digits, len);
+    return ii + 2 - kk + len;
+  }
+  // exponential notation, d[.ddd]e[-]x
+  int jj = 0;
+  s[jj++] = digits[0];
+  if(len > 1) {
+    s[jj++] = '.';
+    memcpy(s + jj, digits + 1, len - 1);
+    jj += len - 1;
+  }
+  s[jj++] = 'e';
+  return ii + jj + intToStr(s + jj, exp10);
+}
+
 // sprintf uses bignum library for printing large floats - I don't believe there is any way to get the same
 //  result more simply.  However, for numbers |x| < 2^53 (for version using fmod), realToStr seems to
 //  match sprintf except for cases involving 0.499.... vs. 0.5
-#if defined(STRINGUTIL_TEST_REALTOSTR) || defined(STRINGUTIL_PERF_REALTOSTR)
+#if defined(STRINGUTIL_TEST_REALTOSTR) || defined(STRINGUTIL_PERF_REALTOSTR) || defined(STRINGUTIL_TEST_STRTOREAL)
 #define PLATFORMUTIL_IMPLEMENTATION
-#include "platformutil.h"
+#include "platformutil.hxx"
 #endif
 
-// g++ -x c++ -O2 -I../stb -DSTRINGUTIL_TEST_REALTOSTR -DSTRINGUTIL_IMPLEMENTATION -o run_stringutil stringutil.h
+// g++ -x c++ -O2 -I../stb -DSTRINGUTIL_TEST_REALTOSTR -DSTRINGUTIL_IMPLEMENTATION -o run_stringutil stringutil.hxx
 #ifdef STRINGUTIL_TEST_REALTOSTR
 int main(int argc, char* argv[])
 {
@@ -583,7 +927,30 @@ int main(int argc, char* argv[])
       PLATFORM_LOG("Mismatch for %.32f: sprintf = %s, dimToStr = %s\n", f, s1, s2);
     }
   }
-  PLATFORM_LOG("realToStr test completed");
+  PLATFORM_LOG("realToStr test completed\n");
+
+  // shortest mode must parse back exactly and never be longer than %.17g / %.9g
+  PLATFORM_LOG("Running realToShortestStr test\n");
+  for(int ii = 0; ii < 10000000; ++ii) {
+    uint64_t bits = (uint64_t(randpp()) << 32) | randpp();
+    double f;
+    memcpy(&f, &bits, sizeof(f));
+    if(!std::isfinite(f)) continue;
+    if(ii % 4 == 0) f = double(randpp())/1000;  // typical SVG coords
+    int len2 = realToStr(s2, f, -1);
+    s2[len2] = '\0';
+    int len1 = sprintf(s1, "%.17g", f);
+    if(strtod(s2, NULL) != f || len2 > len1)
+      PLATFORM_LOG("Mismatch for %.17g: realToShortestStr = %s\n", f, s2);
+    float g = float(f);
+    if(!std::isfinite(g)) continue;
+    len2 = realToStr(s2, g, -1);
+    s2[len2] = '\0';
+    len1 = sprintf(s1, "%.9g", g);
+    if(strtof(s2, NULL) != g || len2 > len1)
+      PLATFORM_LOG("Mismatch for float %.9g: realToShortestStr = %s\n", g, s2);
+  }
+  PLATFORM_LOG("realToShortestStr test completed\n");
 }
 #elif defined(STRINGUTIL_PERF_REALTOSTR)
 int main(int argc, char* argv[])
@@ -594,15 +961,78 @@ int main(int argc, char* argv[])
   for(double f = -10000.0; f < 10000.0; f += 0.0001) {
     realToStr(s1, f, 3);
   }
-  PLATFORM_LOG("realToStr: %d ms", mSecSinceEpoch() - t0);
+  PLATFORM_LOG("realToStr: %d ms\n", int(mSecSinceEpoch() - t0));
+
+  // million point path, as serializePathData would write it
+  std::vector<double> pts(2000000);
+  for(size_t ii = 0; ii < pts.size(); ++ii)
+    pts[ii] = double(randpp() % 2000000)/1000 - 1000;
+  std::vector<char> out(pts.size()*32);
+  for(int prec : {3, -1}) {
+    t0 = mSecSinceEpoch();
+    char* p = out.data();
+    for(size_t ii = 0; ii < pts.size(); ii += 2) {
+      p += realPairToStr(p, pts[ii], pts[ii+1], prec);
+      *p++ = ' ';
+    }
+    Timestamp t1 = mSecSinceEpoch();
+    // verify - parse back
+    size_t nbad = 0;
+    char* q = out.data();
+    for(size_t ii = 0; ii < pts.size(); ++ii) {
+      double f = strtod(q, &q);
+      if(std::abs(f - pts[ii]) > (prec < 0 ? 0 : 0.0005)) ++nbad;
+    }
+    PLATFORM_LOG("1M points, prec %d: %d ms, %d bytes, %d mismatches\n",
+        prec, int(t1 - t0), int(p - out.data()), int(nbad));
+  }
 }
 #endif
 
-// g++ -x c++ -I../stb -DSTRINGUTIL_TEST_BASE64 -DSTRINGUTIL_IMPLEMENTATION -o base64test stringutil.h
-#ifdef STRINGUTIL_TEST_BASE64
+// g++ -x c++ -O2 -I../stb -DSTRINGUTIL_TEST_STRTOREAL -DSTRINGUTIL_IMPLEMENTATION -o strtorealtest stringutil.hxx
+#ifdef STRINGUTIL_TEST_STRTOREAL
+int main(int argc, char* argv[])
+{
+  int nerrors = 0;
+  // exponent is clamped to +/-308, so out of range values are finite, not inf or 0
+  struct { const char* s; double expected; } cases[] = {
+    {"1e400", 1E308}, {"-1e400", -1E308}, {"1E99999", 1E308}, {"0.001e310", 1E305},
+    {"1e-400", 1E-308}, {"-1e-99999", -1E-308}, {"1e308", 1E308}, {"0e400", 0}
+  };
+  for(auto& c : cases) {
+    char* end;
+    double d = strToReal<double>(c.s, &end);
+    if(*end || !std::isfinite(d) || std::abs(d - c.expected) > std::abs(c.expected)*1E-15) {
+      PLATFORM_LOG("strToReal(%s) = %.17g, expected %.17g\n", c.s, d, c.expected);
+      ++nerrors;
+    }
+  }
+  // in range values should match strtod (exactly for <= 15 digits and |exponent| <= 22 after removing point)
+  char buff[64];
+  for(int ii = 0; ii < 1000000; ++ii) {
+    int digits = 1 + randpp() % 15;
+    int exp10 = int(randpp() % 45) - 22;
+    if(ii % 8 == 0)
+      exp10 = int(randpp() % 600) - 300;
+    sprintf(buff, "%s%.*fe%d", ii % 2 ? "-" : "", digits - 1, double(randpp() % 1000000000)/1E8, exp10);
+    double d = strToReal<double>(buff, NULL);
+    double ref = strtod(buff, NULL);
+    double tol = std::abs(exp10 - digits + 1) <= 22 ? 0 : std::abs(ref)*1E-14;
+    if(std::abs(d - ref) > tol) {
+      PLATFORM_LOG("strToReal(%s) = %.17g, strtod = %.17g\n", buff, d, ref);
+      if(++nerrors > 20) break;
+    }
+  }
+  PLATFORM_LOG("strToReal test completed with %d errors\n", nerrors);
+  return nerrors;
+}
+#endif
+
+// g++ -x c++ -O2 -I../stb -DSTRINGUTIL_TEST_BASE64 -DSTRINGUTIL_IMPLEMENTATION -o base64test stringutil.hxx
+#if defined(STRINGUTIL_TEST_BASE64) || defined(STRINGUTIL_PERF_BASE64)
 
 #define PLATFORMUTIL_IMPLEMENTATION
-#include "platformutil.h"
+#include "platformutil.hxx"
 
 std::string randomData(size_t len)
 {
@@ -612,6 +1042,53 @@ std::string randomData(size_t len)
   return s;
 }
 
+#ifdef STRINGUTIL_TEST_BASE64
+int main(int argc, char* argv[])
+{
+  PLATFORM_LOG("Running base64 test\n");
+  for(size_t len = 0; len < 2000; ++len) {
+    std::string s = randomData(len);
+    std::string enc = base64_encode(s);
+    std::vector<unsigned char> dec = base64_decode(enc);
+    if(std::string(dec.begin(), dec.end()) != s)
+      PLATFORM_LOG("Mismatch for len %d\n", int(len));
+    // in-place
+    std::string buff = enc;
+    size_t n = base64_decode(buff.data(), buff.size(), (unsigned char*)&buff[0], BASE64_STRICT);
+    if(n != len || buff.compare(0, n, s) != 0)
+      PLATFORM_LOG("In-place strict mismatch for len %d\n", int(len));
+    // line breaks every 76 chars, as in MIME
+    std::string wrapped;
+    for(size_t ii = 0; ii < enc.size(); ii += 76)
+      wrapped.append(enc, ii, 76).append("\r\n");
+    std::vector<unsigned char> dec2(base64_declen(wrapped.size()));
+    n = base64_decode(wrapped.data(), wrapped.size(), dec2.data(), BASE64_SKIPSPACE);
+    if(n != len || memcmp(dec2.data(), s.data(), len) != 0)
+      PLATFORM_LOG("Whitespace mismatch for len %d\n", int(len));
+    if(len > 0 && base64_decode(wrapped.data(), wrapped.size(), dec2.data(), BASE64_STRICT) != BASE64_ERROR)
+      PLATFORM_LOG("Strict mode accepted whitespace for len %d\n", int(len));
+  }
+  const char* bad[] = {"A", "AB", "ABC", "AB=", "A===", "AB=C", "AB==C", "ABC*", "====", "AB==="};
+  for(const char* b : bad) {
+    unsigned char out[16];
+    if(base64_decode(b, strlen(b), out, BASE64_STRICT) != BASE64_ERROR)
+      PLATFORM_LOG("Strict mode accepted %s\n", b);
+  }
+  PLATFORM_LOG("base64 test completed\n");
+}
+#else
+int main(int argc, char* argv[])
+{
+  std::string enc = base64_encode(randomData(64 << 20));
+  std::vector<unsigned char> dec(base64_declen(enc.size()));
+  Timestamp t0 = mSecSinceEpoch();
+  for(int ii = 0; ii < 10; ++ii)
+    base64_decode(enc.data(), enc.size(), dec.data());
+  Timestamp t1 = mSecSinceEpoch();
+  PLATFORM_LOG("base64_decode: %.0f MB/s\n", 10*enc.size()/1E3/(t1 - t0));
+}
+#endif
+
 #endif
 
 #endif
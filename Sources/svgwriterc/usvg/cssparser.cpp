@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cctype>
 #include <string.h>
+#include "../ulib/stringutil.hxx"
 
 static std::string& lcase(std::string& s)
 {
@@ -14,20 +15,9 @@ static std::string& lcase(std::string& s)
 
 static void trim(std::string &s)
 {
-  size_t pos = s.find_first_not_of(" \n\r\t");
-  if(pos != std::string::npos)
-    s.erase(s.begin(), s.begin() + pos);
-  pos = s.find_last_not_of(" \n\r\t");
-  if(pos != std::string::npos)
-    s.erase(s.begin() + pos + 1, s.end());
-}
-
-static std::string trimmed(const std::string& s)
-{
-  size_t bpos = s.find_first_not_of(" \n\r\t");
-  if(bpos == std::string::npos) return "";
-  size_t epos = s.find_last_not_of(" \n\r\t");
-  return s.substr(bpos, epos == std::string::npos ? epos : epos - bpos + 1);
+  size_t pos = s.find_last_not_of(" \n\r\t");
+  s.erase(pos == std::string::npos ? 0 : pos + 1);
+  s.erase(0, s.find_first_not_of(" \n\r\t"));
 }
 
 static size_t find_close_bracket(const std::string &s, size_t off, char open_b, char close_b)
@@ -248,65 +238,178 @@ int css_selector::calc_specificity()
   return m_left ? m_left->calc_specificity() + specificity : specificity;
 }
 
-void css_stylesheet::parse_selectors(const std::string& txt, const std::string& styles)
+// Stylesheet text is tokenized in a single pass w/o copying except for the text of selectors and declarations,
+//  which is built in reused buffers w/ comments removed.  Quoted strings and (), [] groups are kept intact, but
+//  '{' and '}' always end a token so that a malformed value can't swallow the following rules
+
+static bool at_comment(const StringRef& s) { return s.size() > 1 && s[0] == '/' && s[1] == '*'; }
+
+// s starts w/ "/*"; unterminated comment extends to end
+static void skip_comment(StringRef& s)
 {
-  std::string selstr = txt;
-  trim(selstr);
-  std::vector<std::string> tokens;
-  split_string(selstr, tokens, ",");
-  for(auto tok = tokens.begin(); tok != tokens.end(); tok++) {
-    css_selector* selector = new css_selector;
-    trim(*tok);
-    if(selector->parse(*tok)) {
-      m_rules.emplace_back(selector, createCssDecls(), m_rules.size());  // preserve order from source through sorting
-      m_rules.back().parse_declarations(styles);
+  for(s += 2; s.size() > 1; ++s) {
+    if(s[0] == '*' && s[1] == '/') {
+      s += 2;
+      return;
     }
   }
+  s.advance(s.size());
 }
 
-void css_stylesheet::parse_stylesheet(const char* str)  //, const char* baseurl)
+static void skip_space(StringRef& s)
 {
-  std::string text = str;
-  // remove comments - how to do this because we do blind search for '}' after finding '{'
-  size_t c_start = text.find("/*");
-  while(c_start != std::string::npos) {
-    size_t c_end = text.find("*/", c_start + 2);
-    text.erase(c_start, c_end - c_start + 2);
-    c_start = text.find("/*");
+  while(!s.isEmpty()) {
+    if(isSpace(s[0]))
+      ++s;
+    else if(at_comment(s))
+      skip_comment(s);
+    else
+      break;
   }
+}
 
-  size_t pos = text.find_first_not_of(" \n\r\t");
-  while(pos != std::string::npos) {
-    /*while(pos != tstring::npos && text[pos] == '@')
-    {
-      size_t sPos = pos;
-      pos = text.find_first_of("{;", pos);
-      if(pos != tstring::npos && text[pos] == '{')
-        pos = find_close_bracket(text, pos, '{', '}');
-
-      if(pos != tstring::npos)
-        parse_atrule(text.substr(sPos, pos - sPos + 1), baseurl, doc, media);
-      else
-        parse_atrule(text.substr(sPos), baseurl, doc, media);
+// append text to out until '{', '}', end, or one of delims outside of a string or group; s is left at stop
+static void scan_token(StringRef& s, const char* delims, std::string& out)
+{
+  int depth = 0;
+  const char* run = s.data();
+  while(!s.isEmpty()) {
+    char c = s[0];
+    if(c == '{' || c == '}' || (depth == 0 && strchr(delims, c)))
+      break;
+    if(at_comment(s)) {
+      out.append(run, s.data() - run);
+      skip_comment(s);
+      run = s.data();
+    }
+    else if(c == '"' || c == '\'') {
+      // as in CSS, an unterminated string ends at newline
+      for(++s; !s.isEmpty() && s[0] != c && s[0] != '\n'; ++s) {
+        if(s[0] == '\\' && s.size() > 1)
+          ++s;
+      }
+      if(!s.isEmpty() && s[0] == c)
+        ++s;
+    }
+    else {
+      if(c == '(' || c == '[')
+        ++depth;
+      else if((c == ')' || c == ']') && depth > 0)
+        --depth;
+      ++s;
+    }
+  }
+  out.append(run, s.data() - run);
+}
 
-      if(pos != tstring::npos)
-        pos = text.find_first_not_of(" \n\r\t", pos + 1);
+// s starts w/ '{'; s is left after matching '}'
+static void skip_block(StringRef& s)
+{
+  std::string dummy;
+  int depth = 0;
+  while(!s.isEmpty()) {
+    if(s[0] == '{')
+      ++depth;
+    else if(s[0] == '}' && --depth == 0) {
+      ++s;
+      return;
     }
-    if(pos == tstring::npos)
-      break;
-    */
-    size_t style_start = text.find("{", pos);
-    size_t style_end  = text.find("}", pos);
-    if(style_start != std::string::npos && style_end != std::string::npos) {
-      std::string stylestr = text.substr(style_start + 1, style_end - style_start - 1);
-      parse_selectors(text.substr(pos, style_start - pos), stylestr);
-      pos = style_end + 1;
-    } else {
-      pos = std::string::npos;
+    dummy.clear();
+    ++s;
+    scan_token(s, "", dummy);
+  }
+}
+
+// parse declarations up to closing '}' (or end), passing them to decls if not NULL; s is left at stop
+static void parse_declarations(css_declarations* decls, StringRef& s, std::string& name, std::string& value)
+{
+  while(!s.isEmpty() && s[0] != '}') {
+    name.clear();
+    scan_token(s, ":;", name);
+    if(!s.isEmpty() && s[0] == ':') {
+      value.clear();
+      ++s;
+      scan_token(s, ";", value);
+      trim(name);
+      trim(value);
+      if(decls)
+        decls->parseDecl(name.c_str(), value.c_str());
+    }
+    if(!s.isEmpty() && s[0] == '{')
+      skip_block(s);  // not valid in a declaration
+    else if(!s.isEmpty() && s[0] == ';')
+      ++s;
+  }
+}
+
+// split comma separated list of selectors; invalid selectors are dropped
+static void parse_selectors(StringRef text, std::string& buff, std::vector<std::unique_ptr<css_selector>>& out)
+{
+  out.clear();
+  while(!text.isEmpty()) {
+    buff.clear();
+    scan_token(text, ",", buff);
+    // selector can span multiple lines
+    std::replace(buff.begin(), buff.end(), '\n', ' ');
+    std::replace(buff.begin(), buff.end(), '\r', ' ');
+    trim(buff);
+    auto selector = std::make_unique<css_selector>();
+    if(selector->parse(buff))
+      out.push_back(std::move(selector));
+    if(!text.isEmpty())
+      ++text;  // skip ','
+  }
+}
+
+void css_stylesheet::parse_stylesheet(const char* str)  //, const char* baseurl)
+{
+  // reused for all rules
+  std::string prelude, buff, name, value;
+  std::vector<std::unique_ptr<css_selector>> selectors;
+  StringRef s(str);
+  skip_space(s);
+  while(!s.isEmpty()) {
+    // at-rules (@media, @import, etc.) are not supported
+    bool atrule = s[0] == '@';
+    prelude.clear();
+    scan_token(s, atrule ? ";" : "", prelude);
+    if(!s.isEmpty() && s[0] == '{') {
+      if(atrule)
+        skip_block(s);
+      else {
+        // declaration block is parsed once and shared by all selectors in the list
+        parse_selectors(prelude, buff, selectors);
+        std::shared_ptr<css_declarations> decls(selectors.empty() ? NULL : createCssDecls());
+        ++s;
+        parse_declarations(decls.get(), s, name, value);
+        if(s.isEmpty())
+          break;  // unterminated block is ignored
+        ++s;
+        for(std::unique_ptr<css_selector>& selector : selectors) {
+          m_rules.emplace_back(selector.release(), decls, m_rules.size());  // preserve order from source through sorting
+          m_indexed = false;
+        }
+      }
     }
-    if(pos != std::string::npos)
-      pos = text.find_first_not_of(" \n\r\t", pos);
+    else if(!s.isEmpty())
+      ++s;  // skip ';' ending at-rule or stray '}'
+    skip_space(s);
+  }
+}
+
+// move rules from other (whose source follows ours) to the end of this stylesheet; other must be unsorted
+void css_stylesheet::append_rules(css_stylesheet& other)
+{
+  int order0 = int(m_rules.size());
+  m_rules.reserve(m_rules.size() + other.m_rules.size());
+  for(css_rule& rule : other.m_rules) {
+    rule.m_order += order0;
+    m_rules.push_back(std::move(rule));
   }
+  for(css_rule& rule : m_rules)
+    rule.m_program.clear();  // atoms are per stylesheet
+  other.m_rules.clear();
+  other.m_indexed = m_indexed = false;
 }
 
 // this should be called once after parsing all stylesheets
@@ -316,24 +419,183 @@ void css_stylesheet::sort_rules()
   std::sort(m_rules.begin(), m_rules.end(), [](const css_rule& v1, const css_rule& v2) {
     return (v1.m_specificity == v2.m_specificity) ? (v1.m_order > v2.m_order) : (v1.m_specificity > v2.m_specificity);
   });
+  index_rules();
 }
 
-/// css_rule ///
+uint32_t css_hash(char kind, const char* s, size_t len)
+{
+  uint32_t h = 2166136261u ^ uint8_t(kind);
+  for(size_t ii = 0; ii < len; ++ii)
+    h = (h ^ uint8_t(s[ii])) * 16777619u;
+  return h;
+}
+
+static void add_selector_hashes(const css_element_selector& sel, std::vector<uint32_t>& hashes)
+{
+  if(!sel.m_tag.empty() && sel.m_tag != "*")
+    hashes.push_back(css_hash(0, sel.m_tag.data(), sel.m_tag.size()));
+  for(const css_attribute_selector& attr : sel.m_attrs) {
+    if(attr.condition == select_equal && (attr.attribute == "id" || attr.attribute == "class"))
+      hashes.push_back(css_hash(attr.attribute == "id" ? '#' : '.', attr.val.data(), attr.val.size()));
+  }
+}
+
+// WebKit-style rule hash: an element only needs to test rules keyed by its id, one of its classes, or its tag,
+//  plus the universal rules
+void css_stylesheet::index_rules()
+{
+  m_keyedRules.clear();
+  m_universalRules.clear();
+  m_invalidation.clear();
+  m_atomNames.clear();
+  m_atomHashes.clear();
+  m_atomSlots.clear();
+  for(size_t ii = 0; ii < m_rules.size(); ++ii) {
+    css_rule& rule = m_rules[ii];
+    compile_selector(rule);
+    const css_element_selector& right = rule.m_selector->m_right;
+    const css_attribute_selector* idattr = NULL;
+    const css_attribute_selector* classattr = NULL;
+    for(const css_attribute_selector& attr : right.m_attrs) {
+      if(attr.condition == select_equal && attr.attribute == "id" && !idattr)
+        idattr = &attr;
+      else if(attr.condition == select_equal && attr.attribute == "class" && !classattr)
+        classattr = &attr;
+    }
+    if(idattr)
+      m_keyedRules[css_hash('#', idattr->val.data(), idattr->val.size())].push_back(ii);
+    else if(classattr)
+      m_keyedRules[css_hash('.', classattr->val.data(), classattr->val.size())].push_back(ii);
+    else if(!right.m_tag.empty() && right.m_tag != "*")
+      m_keyedRules[css_hash(0, right.m_tag.data(), right.m_tag.size())].push_back(ii);
+    else
+      m_universalRules.push_back(ii);
+
+    rule.m_simple = !rule.m_selector->m_left;
+    for(const css_attribute_selector& attr : right.m_attrs) {
+      if(attr.condition != select_equal || (attr.attribute != "id" && attr.attribute != "class"))
+        rule.m_simple = false;
+    }
+
+    // sibling combinators are not supported (never match), so we stop there
+    rule.m_ancestorHashes.clear();
+    for(const css_selector* sel = rule.m_selector.get(); sel->m_left; sel = sel->m_left.get()) {
+      if(sel->m_combinator != combinator_descendant && sel->m_combinator != combinator_child)
+        break;
+      add_selector_hashes(sel->m_left->m_right, rule.m_ancestorHashes);
+    }
+
+    // invalidation sets - tags are not included since they can't change
+    std::vector<uint32_t> hashes;
+    add_selector_hashes(right, hashes);
+    int selfinval = rule.decls()->affectsDescendants() ? invalidate_subtree : invalidate_self;
+    for(uint32_t hash : hashes)
+      m_invalidation[hash] |= selfinval;
+    for(uint32_t hash : rule.m_ancestorHashes)
+      m_invalidation[hash] |= invalidate_subtree;
+  }
+  m_indexed = true;
+  rules_indexed();
+}
+
+int css_stylesheet::find_atom(char kind, const char* name, size_t len) const
+{
+  if(m_atomSlots.empty())
+    return -1;
+  uint32_t hash = css_hash(kind, name, len);
+  size_t mask = m_atomSlots.size() - 1;
+  for(size_t ii = hash & mask; m_atomSlots[ii] >= 0; ii = (ii + 1) & mask) {
+    int atom = m_atomSlots[ii];
+    const std::string& atomname = m_atomNames[atom];
+    if(m_atomHashes[atom] == hash && atomname.size() == len + 1 && atomname[0] == kind
+        && memcmp(atomname.data() + 1, name, len) == 0)
+      return atom;
+  }
+  return -1;
+}
+
+int css_stylesheet::add_atom(char kind, const std::string& name)
+{
+  int atom = find_atom(kind, name.data(), name.size());
+  if(atom >= 0)
+    return atom;
+  atom = int(m_atomNames.size());
+  m_atomNames.push_back(std::string(1, kind) + name);
+  m_atomHashes.push_back(css_hash(kind, name.data(), name.size()));
+  // keep load factor <= 1/2
+  if(2*m_atomNames.size() > m_atomSlots.size()) {
+    m_atomSlots.assign(std::max(size_t(16), 2*m_atomSlots.size()), -1);
+    for(int ii = 0; ii < atom; ++ii) {
+      size_t slot = m_atomHashes[ii] & (m_atomSlots.size() - 1);
+      while(m_atomSlots[slot] >= 0)
+        slot = (slot + 1) & (m_atomSlots.size() - 1);
+      m_atomSlots[slot] = ii;
+    }
+  }
+  size_t slot = m_atomHashes[atom] & (m_atomSlots.size() - 1);
+  while(m_atomSlots[slot] >= 0)
+    slot = (slot + 1) & (m_atomSlots.size() - 1);
+  m_atomSlots[slot] = atom;
+  return atom;
+}
 
-void css_rule::parse_declarations(const std::string& stylestr)
+void css_stylesheet::compile_selector(css_rule& rule)
 {
-  std::vector<std::string> styles;
-  split_string(stylestr, styles, ";");
-  for(std::string& style : styles) {
-    size_t colon = style.find(':');
-    if(colon != std::string::npos) {
-      std::string name(style, 0, colon);
-      std::string value(style, colon+1);
-      m_decls->parseDecl(trimmed(name).c_str(), trimmed(value).c_str());
+  rule.m_program.clear();
+  rule.m_attrSelectors.clear();
+  for(const css_selector* sel = rule.m_selector.get(); sel; sel = sel->m_left.get()) {
+    const css_element_selector& right = sel->m_right;
+    if(!right.m_tag.empty() && right.m_tag != "*")
+      rule.m_program.push_back({op_tag, add_atom(0, right.m_tag)});
+    for(const css_attribute_selector& attr : right.m_attrs) {
+      if(attr.condition == select_equal && attr.attribute == "class")
+        rule.m_program.push_back({op_class, add_atom('.', attr.val)});
+      else if(attr.condition == select_equal && attr.attribute == "id")
+        rule.m_program.push_back({op_id, add_atom('#', attr.val)});
+      else {
+        rule.m_program.push_back({op_attr, int(rule.m_attrSelectors.size())});
+        rule.m_attrSelectors.push_back(&attr);
+      }
+    }
+    if(!sel->m_left)
+      rule.m_program.push_back({op_end, 0});
+    else if(sel->m_combinator == combinator_descendant)
+      rule.m_program.push_back({op_descendant, 0});
+    else if(sel->m_combinator == combinator_child)
+      rule.m_program.push_back({op_child, 0});
+    else {
+      rule.m_program.push_back({op_fail, 0});  // sibling combinators not supported
+      break;
     }
   }
 }
 
+bool css_stylesheet::candidate_rules(const char* id, const char* tag, const char* classes, std::vector<int>* out) const
+{
+  if(!m_indexed)
+    return false;
+  size_t n0 = out->size();
+  auto addBucket = [&](uint32_t hash) {
+    auto it = m_keyedRules.find(hash);
+    if(it != m_keyedRules.end())
+      out->insert(out->end(), it->second.begin(), it->second.end());
+  };
+  if(id && id[0])
+    addBucket(css_hash('#', id, strlen(id)));
+  if(tag && tag[0])
+    addBucket(css_hash(0, tag, strlen(tag)));
+  const char* p = classes ? classes : "";
+  for(StringRef word = nextWord(p); !word.isEmpty(); word = nextWord(p))
+    addBucket(css_hash('.', word.data(), word.size()));
+  out->insert(out->end(), m_universalRules.begin(), m_universalRules.end());
+  // rules must be applied in priority order; a rule can appear twice if class is repeated
+  std::sort(out->begin() + n0, out->end());
+  out->erase(std::unique(out->begin() + n0, out->end()), out->end());
+  return true;
+}
+
+/// css_rule ///
+
 // matching code from litehtml html_tag.cpp
 
 bool css_rule::element_select(void* el, const css_element_selector& selector) const
@@ -348,36 +610,146 @@ bool css_rule::element_select(void* el, const css_element_selector& selector) co
     } else if(i->condition == select_equal && i->attribute == "id") {
       if(!m_decls->hasId(el, i->val.c_str()))
         return false;
-    } else {
-      const char* attr_value = m_decls->attribute(el, i->attribute.c_str());
-      if(!attr_value)
+    } else if(!attribute_select(el, *i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// attribute value is lowercased for comparison - done char by char to avoid copying it
+bool css_rule::attribute_select(void* el, const css_attribute_selector& sel) const
+{
+  const char* value = m_decls->attribute(el, sel.attribute.c_str());
+  if(!value)
+    return false;
+  size_t len = strlen(value), n = sel.val.size();
+  auto equal_at = [&](size_t pos) {
+    for(size_t ii = 0; ii < n; ++ii) {
+      if(char(std::tolower(value[pos + ii])) != sel.val[ii])
         return false;
-      std::string attr_str(attr_value);
-      lcase(attr_str);
-      switch(i->condition) {
-      case select_exists:
-        break;
-      case select_equal:
-        if(attr_str != i->val)
-          return false;
-        break;
-      case select_contain_str:
-        if(!strstr(attr_str.c_str(), i->val.c_str()))
-          return false;
-        break;
-      case select_start_str:
-        if(strncmp(attr_str.c_str(), i->val.c_str(), i->val.length()) != 0)
-          return false;
-        break;
-      case select_end_str:
-        if(i->val.size() > attr_str.size()
-            || strcmp(attr_str.c_str() + attr_str.size() - i->val.size(), i->val.c_str()) != 0)
-          return false;
-        break;
-      default:
+    }
+    return true;
+  };
+  switch(sel.condition) {
+  case select_exists:
+    return true;
+  case select_equal:
+    return len == n && equal_at(0);
+  case select_contain_str:
+    for(size_t pos = 0; pos + n <= len; ++pos) {
+      if(equal_at(pos))
+        return true;
+    }
+    return false;
+  case select_start_str:
+    return len >= n && equal_at(0);
+  case select_end_str:
+    return len >= n && equal_at(len - n);
+  default:
+    return false;
+  }
+}
+
+bool css_rule::select(css_match_context& ctx) const
+{
+  return m_program.empty() ? select(ctx.element()) : run_program(ctx, 0, 0);
+}
+
+bool css_rule::run_program(css_match_context& ctx, size_t pc, size_t depth) const
+{
+  const css_element_atoms& el = ctx.atoms(depth, m_decls.get());
+  for(;; ++pc) {
+    const css_op& op = m_program[pc];
+    switch(op.code) {
+    case op_tag:
+      if(el.tag != op.arg)
+        return false;
+      break;
+    case op_id:
+      if(el.id != op.arg)
         return false;
+      break;
+    case op_class:
+      if(!ctx.has_class(el, op.arg))
+        return false;
+      break;
+    case op_attr:
+      if(!attribute_select(el.el, *m_attrSelectors[op.arg]))
+        return false;
+      break;
+    case op_fail:
+      return false;
+    case op_end:
+      return true;
+    // note that el may be invalidated by resolving atoms of ancestors
+    case op_child:
+      return ctx.atoms(depth + 1, m_decls.get()).el && run_program(ctx, pc + 1, depth + 1);
+    case op_descendant:
+      for(size_t d = depth + 1; ctx.atoms(d, m_decls.get()).el; ++d) {
+        if(run_program(ctx, pc + 1, d))
+          return true;
       }
+      return false;
+    }
+  }
+}
+
+/// css_match_context ///
+
+void css_match_context::reset(const css_stylesheet* sheet, void* el)
+{
+  if(m_chain.empty())
+    m_chain.resize(1);
+  m_sheet = sheet;
+  m_chain[0].el = el;
+  m_resolved = 0;
+  m_classes.clear();
+}
+
+const css_element_atoms& css_match_context::resolve(size_t depth, const css_declarations* decls)
+{
+  while(m_resolved <= depth) {
+    void* el = m_chain[0].el;
+    if(m_resolved > 0)
+      el = m_chain[m_resolved - 1].el ? decls->parent(m_chain[m_resolved - 1].el) : NULL;
+    if(m_chain.size() <= m_resolved)
+      m_chain.emplace_back();
+    css_element_atoms& atoms = m_chain[m_resolved++];
+    atoms = css_element_atoms();
+    atoms.el = el;
+    if(!el)
+      continue;
+    const char* tag = decls->tagName(el);
+    atoms.tag = m_sheet->find_atom(0, tag, strlen(tag));
+    const char* id = decls->idName(el);
+    if(id[0])
+      atoms.id = m_sheet->find_atom('#', id, strlen(id));
+    atoms.classes_begin = m_classes.size();
+    const char* p = decls->classNames(el);
+    for(StringRef word = nextWord(p); !word.isEmpty(); word = nextWord(p)) {
+      int atom = m_sheet->find_atom('.', word.data(), word.size());
+      if(atom >= 0)
+        m_classes.push_back(atom);
     }
+    atoms.classes_end = m_classes.size();
+  }
+  return m_chain[depth];
+}
+
+int css_stylesheet::invalidation(char kind, const char* name, size_t len) const
+{
+  if(!m_indexed)
+    return invalidate_subtree;
+  auto it = m_invalidation.find(css_hash(kind, name, len));
+  return it != m_invalidation.end() ? it->second : invalidate_none;
+}
+
+bool css_rule::may_match(const css_ancestor_filter& ancestors) const
+{
+  for(uint32_t hash : m_ancestorHashes) {
+    if(!ancestors.mayContain(hash))
+      return false;
   }
   return true;
 }
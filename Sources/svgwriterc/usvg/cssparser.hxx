@@ -6,6 +6,9 @@
 #include <vector>
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
 
 enum attr_select_condition
 {
@@ -47,6 +50,22 @@ public:
   int calc_specificity();
 };
 
+// hash of id ('#'), class ('.'), or tag (0) name used to index rules and for ancestor filter
+uint32_t css_hash(char kind, const char* s, size_t len);
+
+// Bloom filter of hashed ids, classes, and tags of an element's ancestors - lets us reject a rule w/ descendant or
+//  child combinators w/o walking up the tree if some id/class/tag it requires is not present on any ancestor
+struct css_ancestor_filter
+{
+  uint64_t bits[4] = {0, 0, 0, 0};
+
+  void add(uint32_t hash) { bits[hash & 3] |= 1ull << ((hash >> 2) & 63);  bits[(hash >> 8) & 3] |= 1ull << ((hash >> 10) & 63); }
+  bool mayContain(uint32_t hash) const
+  {
+    return (bits[hash & 3] & (1ull << ((hash >> 2) & 63))) && (bits[(hash >> 8) & 3] & (1ull << ((hash >> 10) & 63)));
+  }
+};
+
 // subclass this to store declarations (passed to parseDecl) and provide fns needed for selector matching
 class css_declarations
 {
@@ -57,7 +76,62 @@ public:
   virtual bool hasId(void* el, const char* id) const = 0;
   virtual const char* attribute(void* el, const char* name) const = 0;
   virtual void* parent(void* el) const = 0;
+  // for compiled selectors: element's tag, id (empty if none), and space separated classes
+  virtual const char* tagName(void* el) const = 0;
+  virtual const char* idName(void* el) const = 0;
+  virtual const char* classNames(void* el) const = 0;
   virtual void parseDecl(const char* name, const char* value) = 0;
+  // true if declarations can change style of descendants of matching element (e.g. by setting CSS variables)
+  virtual bool affectsDescendants() const { return false; }
+};
+
+class css_stylesheet;
+
+// compiled selector: compound selectors from right to left, each terminated by op_child, op_descendant, or
+//  op_end; tag, id, and class names are replaced by atoms assigned by the stylesheet so matching needs no
+//  string comparison
+enum css_opcode : uint8_t { op_tag, op_id, op_class, op_attr, op_fail, op_child, op_descendant, op_end };
+struct css_op
+{
+  css_opcode code;
+  int arg;  // atom, or index into css_rule::m_attrSelectors for op_attr
+};
+
+// tag, id, and classes of an element as atoms (-1 if name is not used by any selector)
+struct css_element_atoms
+{
+  void* el = NULL;
+  int tag = -1;
+  int id = -1;
+  size_t classes_begin = 0;  // range of class atoms in css_match_context
+  size_t classes_end = 0;
+};
+
+// atoms of element being styled and its ancestors (resolved as needed); reuse for multiple elements to avoid
+//  allocation
+class css_match_context
+{
+public:
+  void reset(const css_stylesheet* sheet, void* el);
+  void* element() const { return m_chain[0].el; }
+  // atoms of element (depth 0) or ancestor; el is NULL if depth is past root
+  const css_element_atoms& atoms(size_t depth, const css_declarations* decls)
+  {
+    return depth < m_resolved ? m_chain[depth] : resolve(depth, decls);
+  }
+  bool has_class(const css_element_atoms& atoms, int cls) const
+  {
+    return std::find(m_classes.begin() + atoms.classes_begin, m_classes.begin() + atoms.classes_end, cls)
+        != m_classes.begin() + atoms.classes_end;
+  }
+
+private:
+  const css_stylesheet* m_sheet = NULL;
+  std::vector<css_element_atoms> m_chain;
+  std::vector<int> m_classes;
+  size_t m_resolved = 0;
+
+  const css_element_atoms& resolve(size_t depth, const css_declarations* decls);
 };
 
 // rule = selector + declaration block
@@ -65,20 +139,28 @@ class css_rule
 {
 public:
   std::unique_ptr<css_selector> m_selector;
-  std::unique_ptr<css_declarations> m_decls;
+  std::shared_ptr<css_declarations> m_decls;  // shared by rules from a selector list, e.g. "a, b { ... }"
   int m_specificity = 0;
   int m_order = 0;
+  std::vector<uint32_t> m_ancestorHashes;  // css_hash()es required on ancestors of matching element
+  bool m_simple = false;  // selector only tests element's own tag, id, and classes
+  std::vector<css_op> m_program;  // compiled selector, set by css_stylesheet::index_rules()
+  std::vector<const css_attribute_selector*> m_attrSelectors;  // for op_attr (point into m_selector)
 
-  css_rule(css_selector* sel, css_declarations* decls, int order)
-    : m_selector(sel), m_decls(decls), m_specificity(sel->calc_specificity()), m_order(order) {}
+  css_rule(css_selector* sel, std::shared_ptr<css_declarations> decls, int order)
+    : m_selector(sel), m_decls(std::move(decls)), m_specificity(sel->calc_specificity()), m_order(order) {}
   const css_declarations* decls() const { return m_decls.get(); }
-  void parse_declarations(const std::string& stylestr);
   bool select(void* el) const { return select(el, *m_selector); }
+  // match compiled selector against ctx.element(); falls back to select(el) if not compiled
+  bool select(css_match_context& ctx) const;
+  bool may_match(const css_ancestor_filter& ancestors) const;
 
 private:
   bool select(void* el, const css_selector& selector) const;
   bool select_ancestor(void* el, const css_selector& selector) const;
   bool element_select(void* el, const css_element_selector& selector) const;
+  bool attribute_select(void* el, const css_attribute_selector& sel) const;
+  bool run_program(css_match_context& ctx, size_t pc, size_t depth) const;
 };
 
 // pass stylesheet(s) as text to parse_stylesheet(), then call sort_rules() after last stylesheet
@@ -90,9 +172,35 @@ public:
   const std::vector<css_rule>& rules() const { return m_rules; }
   void parse_stylesheet(const char* str);  //, const char* baseurl);
   void sort_rules();
+  void append_rules(css_stylesheet& other);
+  // append indices (in priority order) of rules that could match an element w/ given id, tag, and space separated
+  //  classes; returns false if rules have not been indexed by sort_rules(), in which case all must be tested
+  bool candidate_rules(const char* id, const char* tag, const char* classes, std::vector<int>* out) const;
+  // which elements must be restyled when an element gains or loses id ('#') or class ('.') name: none if no
+  //  selector refers to it, just the element if only rightmost compound selectors do, otherwise its subtree
+  enum invalidation_t { invalidate_none = 0, invalidate_self = 1, invalidate_subtree = 2 };
+  int invalidation(char kind, const char* name, size_t len) const;
+  // atom for id ('#'), class ('.'), or tag (0) name, or -1 if not used by any selector
+  int find_atom(char kind, const char* name, size_t len) const;
 
 private:
   std::vector<css_rule> m_rules;
+  // rules are bucketed by css_hash() of rightmost compound selector's id, else its first class, else its tag
+  std::unordered_map<uint32_t, std::vector<int>> m_keyedRules;
+  std::vector<int> m_universalRules;
+  std::unordered_map<uint32_t, int> m_invalidation;  // css_hash() -> invalidation_t
+  bool m_indexed = false;
+  // atoms are indices into m_atomNames (w/ kind prefixed to name); found by css_hash() in open addressing
+  //  table m_atomSlots (size is power of 2, -1 for empty slot)
+  std::vector<std::string> m_atomNames;
+  std::vector<uint32_t> m_atomHashes;
+  std::vector<int> m_atomSlots;
+
+  void index_rules();
+  int add_atom(char kind, const std::string& name);
+  void compile_selector(css_rule& rule);
 
-  void parse_selectors(const std::string& txt, const std::string& styles);
+protected:
+  // called after rules are (re)sorted and indexed - rule indices previously passed to subclass are invalid
+  virtual void rules_indexed() {}
 };
@@ -1,3 +1,4 @@
+#include <unordered_set>
 #include "svgnode.hxx"
 #include "svgstyleparser.hxx"
 #include "svgpainter.hxx"  // only needed for bounds()
@@ -6,36 +7,145 @@
 const char* SvgLength::unitNames[] = {"px", "pt", "em", "ex", "%"};
 real SvgLength::defaultDpi = 96;
 
-// we could add a separate constexpr fn to do this mapping at compile time for things like case labels,
-//  e.g. case SVG_ATTR("fill"):  but I'm not sure the extra complication is worthwhile
-SvgAttr::StdAttr SvgAttr::nameToStdAttr(const char* name)
-{
-    static std::unordered_map<std::string, StdAttr> stdAttrMap = {
-        {"color", COLOR}, {"comp-op", COMP_OP}, {"display", DISPLAY}, {"fill", FILL}, {"fill-opacity", FILL_OPACITY},
-        {"fill-rule", FILL_RULE}, {"font-family", FONT_FAMILY}, {"font-size", FONT_SIZE},
-        {"font-style", FONT_STYLE}, {"font-variant", FONT_VARIANT}, {"font-weight", FONT_WEIGHT},
-        {"offset", OFFSET}, {"opacity", OPACITY}, {"shape-rendering", SHAPE_RENDERING}, {"stop-color", STOP_COLOR},
-        {"stop-opacity", STOP_OPACITY}, {"stroke", STROKE}, {"stroke-dasharray", STROKE_DASHARRAY},
-        {"stroke-dashoffset", STROKE_DASHOFFSET}, {"stroke-linecap", STROKE_LINECAP},
-        {"stroke-linejoin", STROKE_LINEJOIN}, {"stroke-miterlimit", STROKE_MITERLIMIT},
-        {"stroke-opacity", STROKE_OPACITY}, {"stroke-width", STROKE_WIDTH}, {"text-anchor", TEXT_ANCHOR},
-        {"vector-effect", VECTOR_EFFECT}, {"visibility", VISIBILITY}, {"letter-spacing", LETTER_SPACING}
-    };
+// names indexed by StdAttr; these string literals are also the interned names for standard attributes
+static const char* stdAttrNames[] = {"", "color", "comp-op", "display", "fill", "fill-opacity", "fill-rule",
+    "font-family", "font-size", "font-style", "font-variant", "font-weight", "offset", "opacity",
+    "shape-rendering", "stop-color", "stop-opacity", "stroke", "stroke-dasharray", "stroke-dashoffset",
+    "stroke-linecap", "stroke-linejoin", "stroke-miterlimit", "stroke-opacity", "stroke-width", "text-anchor",
+    "vector-effect", "visibility", "letter-spacing"};
+static_assert(sizeof(stdAttrNames)/sizeof(stdAttrNames[0]) == SvgAttr::LETTER_SPACING + 1,
+              "stdAttrNames doesn't match StdAttr");
+
+// switch on constHash - compiler checks for collisions (duplicate case labels), so only one strcmp is needed
+SvgAttr::StdAttr SvgAttr::nameToStdAttr(const char* name, size_t len)
+{
+    StdAttr stdattr;
+    switch(constHash(name, len)) {
+        case constHash("color"): stdattr = COLOR; break;
+        case constHash("comp-op"): stdattr = COMP_OP; break;
+        case constHash("display"): stdattr = DISPLAY; break;
+        case constHash("fill"): stdattr = FILL; break;
+        case constHash("fill-opacity"): stdattr = FILL_OPACITY; break;
+        case constHash("fill-rule"): stdattr = FILL_RULE; break;
+        case constHash("font-family"): stdattr = FONT_FAMILY; break;
+        case constHash("font-size"): stdattr = FONT_SIZE; break;
+        case constHash("font-style"): stdattr = FONT_STYLE; break;
+        case constHash("font-variant"): stdattr = FONT_VARIANT; break;
+        case constHash("font-weight"): stdattr = FONT_WEIGHT; break;
+        case constHash("offset"): stdattr = OFFSET; break;
+        case constHash("opacity"): stdattr = OPACITY; break;
+        case constHash("shape-rendering"): stdattr = SHAPE_RENDERING; break;
+        case constHash("stop-color"): stdattr = STOP_COLOR; break;
+        case constHash("stop-opacity"): stdattr = STOP_OPACITY; break;
+        case constHash("stroke"): stdattr = STROKE; break;
+        case constHash("stroke-dasharray"): stdattr = STROKE_DASHARRAY; break;
+        case constHash("stroke-dashoffset"): stdattr = STROKE_DASHOFFSET; break;
+        case constHash("stroke-linecap"): stdattr = STROKE_LINECAP; break;
+        case constHash("stroke-linejoin"): stdattr = STROKE_LINEJOIN; break;
+        case constHash("stroke-miterlimit"): stdattr = STROKE_MITERLIMIT; break;
+        case constHash("stroke-opacity"): stdattr = STROKE_OPACITY; break;
+        case constHash("stroke-width"): stdattr = STROKE_WIDTH; break;
+        case constHash("text-anchor"): stdattr = TEXT_ANCHOR; break;
+        case constHash("vector-effect"): stdattr = VECTOR_EFFECT; break;
+        case constHash("visibility"): stdattr = VISIBILITY; break;
+        case constHash("letter-spacing"): stdattr = LETTER_SPACING; break;
+        default: return UNKNOWN;
+    }
+    const char* stdname = stdAttrNames[stdattr];
+    return strncmp(name, stdname, len) == 0 && !stdname[len] ? stdattr : UNKNOWN;
+}
+
+const char* SvgAttr::stdAttrName(StdAttr stdattr) { return stdAttrNames[stdattr]; }
+
+// other presentation attributes and attributes usually consumed by parser (which can still end up in attrs of
+//  other elements); must be sorted (by strcmp) for binary search
+static const char* knownAttrNames[] = {"alignment-baseline", "baseline-shift", "class", "clip", "clip-path",
+    "clip-rule", "color-interpolation", "color-interpolation-filters", "color-profile", "color-rendering", "cursor",
+    "cx", "cy", "d", "direction", "dominant-baseline", "enable-background", "filter", "flood-color",
+    "flood-opacity", "font", "font-size-adjust", "font-stretch", "fx", "fy", "glyph-orientation-horizontal",
+    "glyph-orientation-vertical", "gradientTransform", "gradientUnits", "height", "href", "id", "image-rendering",
+    "isolation", "kerning", "lighting-color", "marker", "marker-end", "marker-mid", "marker-start", "mask",
+    "mix-blend-mode", "overflow", "paint-order", "patternContentUnits", "patternTransform", "patternUnits",
+    "pointer-events", "points", "preserveAspectRatio", "r", "rx", "ry", "spreadMethod", "startOffset", "style",
+    "text-decoration", "text-rendering", "transform", "type", "unicode-bidi", "version", "viewBox", "width",
+    "word-spacing", "writing-mode", "x", "x1", "x2", "xlink:href", "xml:id", "xml:space", "xmlns", "xmlns:xlink",
+    "y", "y1", "y2"};
+
+// fixed tables, so no locking is needed even though nodes can be created on multiple threads
+const char* SvgAttr::internName(const char* name)
+{
+    StdAttr stdattr = nameToStdAttr(name);
+    if(stdattr != UNKNOWN || !name[0])
+        return stdAttrNames[stdattr];
+    auto end = std::end(knownAttrNames);
+    auto it = std::lower_bound(std::begin(knownAttrNames), end, name,
+        [](const char* a, const char* b){ return strcmp(a, b) < 0; });
+    return it != end && strcmp(*it, name) == 0 ? *it : NULL;
+}
+
+void SvgAttr::initName(const char* name)
+{
+    m_name = stdAttr() != UNKNOWN ? stdAttrNames[stdAttr()] : internName(name);
+    if(!m_name) {
+        m_name = SharedStr::create(name, strlen(name))->data;
+        flags |= OwnedName;
+    }
+}
 
-    auto it = stdAttrMap.find(name);
-    return it != stdAttrMap.end() ? it->second : UNKNOWN;
+SvgAttr::SharedStr* SvgAttr::SharedStr::create(const char* s, size_t len)
+{
+    if(len == 0)
+        return NULL;
+    SharedStr* str = static_cast<SharedStr*>(malloc(sizeof(SharedStr) + len));
+    new (&str->refs) std::atomic<int>(1);
+    str->len = len;
+    memcpy(str->data, s, len);
+    str->data[len] = '\0';
+    return str;
+}
+
+SvgAttr& SvgAttr::operator=(const SvgAttr& other)
+{
+    if(other.valueIs(StringVal))
+        SharedStr::retain(other.value.strVal);
+    if(other.flags & OwnedName)
+        SharedStr::retain(other.nameStr());
+    if(valueIs(StringVal))
+        SharedStr::release(value.strVal);
+    if(flags & OwnedName)
+        SharedStr::release(nameStr());
+    m_name = other.m_name;
+    value = other.value;
+    flags = other.flags;
+    return *this;
+}
+
+SvgAttr& SvgAttr::operator=(SvgAttr&& other) noexcept
+{
+    if(this != &other) {
+        if(valueIs(StringVal))
+            SharedStr::release(value.strVal);
+        if(flags & OwnedName)
+            SharedStr::release(nameStr());
+        m_name = other.m_name;
+        value = other.value;
+        flags = other.flags;
+        other.flags = IntVal;
+    }
+    return *this;
 }
 
 bool operator==(const SvgAttr& a, const SvgAttr& b)
 {
-    if(a.flags != b.flags || a.str != b.str)
+    if(a.flags != b.flags || a.m_name != b.m_name)
         return false;
     // In C++ I think memcmp would work here (but not C due to unintialized padding)
     switch(a.valueType()) {
         case SvgAttr::IntVal: return a.value.intVal == b.value.intVal;
         case SvgAttr::ColorVal: return a.value.colorVal == b.value.colorVal;
         case SvgAttr::FloatVal: return a.value.floatVal == b.value.floatVal;
-        case SvgAttr::StringVal: return a.value.strOffset == b.value.strOffset;
+        case SvgAttr::StringVal: return a.value.strVal == b.value.strVal || (a.stringLen() == b.stringLen()
+            && memcmp(a.stringVal(), b.stringVal(), a.stringLen()) == 0);
     }
     return false;
 }
@@ -47,10 +157,46 @@ const char* SvgNode::nodeNames[] = {"svg", "g", "a", "defs", "symbol", "pattern"
 static_assert(sizeof(SvgNode::nodeNames)/sizeof(SvgNode::nodeNames[0]) == SvgNode::NUM_NODE_TYPES,
               "nodeNodes doesn't match Type");
 
+// see SvgAttr::nameToStdAttr()
+int SvgNode::nameToType(const char* name)
+{
+    int type;
+    switch(constHash(name)) {
+        case constHash("svg"): type = DOC; break;
+        case constHash("g"): type = G; break;
+        case constHash("a"): type = A; break;
+        case constHash("defs"): type = DEFS; break;
+        case constHash("symbol"): type = SYMBOL; break;
+        case constHash("pattern"): type = PATTERN; break;
+        case constHash("gradient"): type = GRADIENT; break;
+        case constHash("stop"): type = STOP; break;
+        case constHash("font"): type = FONT; break;
+        case constHash("font-face"): type = FONTFACE; break;
+        case constHash("glyph"): type = GLYPH; break;
+        case constHash("arc"): type = ARC; break;
+        case constHash("circle"): type = CIRCLE; break;
+        case constHash("ellipse"): type = ELLIPSE; break;
+        case constHash("image"): type = IMAGE; break;
+        case constHash("line"): type = LINE; break;
+        case constHash("path"): type = PATH; break;
+        case constHash("polygon"): type = POLYGON; break;
+        case constHash("polyline"): type = POLYLINE; break;
+        case constHash("rect"): type = RECT; break;
+        case constHash("text"): type = TEXT; break;
+        case constHash("tspan"): type = TSPAN; break;
+        case constHash("textPath"): type = TEXTPATH; break;
+        case constHash("use"): type = USE; break;
+        case constHash("unknown"): type = UNKNOWN; break;
+        case constHash("custom"): type = CUSTOM; break;
+        default: return -1;
+    }
+    return strcmp(name, nodeNames[type]) == 0 ? type : -1;
+}
+
 Transform2D SvgNode::identityTransform;
 
 // we override default copy constructor to clear parent, and update ext node pointer; we no longer clear id
-SvgNode::SvgNode(const SvgNode& n) : attrs(n.attrs), transform(n.transform ? new Transform2D(*n.transform) : NULL),
+SvgNode::SvgNode(const SvgNode& n) : attrs(n.attrs), m_stdAttrs(n.m_stdAttrs), transform(n.transform ? new Transform2D(*n.transform) : NULL),
 m_cachedBounds(), m_renderedBounds(), m_dirty(NOT_DIRTY), m_parent(NULL),
 m_ext(n.m_ext ? n.m_ext->clone() : NULL), m_visible(n.m_visible), m_id(n.m_id), m_class(n.m_class)
 {
@@ -79,6 +225,7 @@ void SvgNode::setExt(SvgNodeExtension* ext)
 {
     ASSERT(!m_ext && "SvgNode extension already set!");
     m_ext.reset(ext);
+    invalidatePaintState();  // ext can apply style
     //setRestyle();  -- don't know why this was added ... exts can do manually from constructor if needed
 }
 
@@ -138,8 +285,12 @@ void SvgNode::invalidateBounds(bool inclChildren, bool inclParents) const
     m_cachedBounds = SVGRect();
     // minor optimization: if a node's bounds are valid, then all children bounds are valid, thus if our bounds
     //  are already invalid, we could skip this since parent bounds should also be invalidated already
-    if(inclParents && m_parent && isVisible())
+    if(inclParents && m_parent && isVisible()) {
+        const SvgContainerNode* parent = m_parent->asContainerNode();
+        if(parent && parent->m_boundsIndex)
+            parent->m_boundsIndex->invalidate(this);
         m_parent->invalidateBounds(false, true);
+    }
 }
 
 // TODO: clear transform if tf is identity?
@@ -149,6 +300,7 @@ void SvgNode::setTransform(const Transform2D& tf)
         *transform = tf;
     else
         transform.reset(new Transform2D(tf));
+    invalidatePaintState();
     invalidate(true);
 }
 
@@ -179,9 +331,24 @@ SvgDocument* SvgNode::rootDocument() const
     return node->type() == SvgNode::DOC ? static_cast<SvgDocument*>(node) : NULL;
 }
 
+// nothing is cached for detached nodes or while parser is creating the document
+void SvgNode::invalidatePaintState() const
+{
+    SvgDocument* root = rootDocument();
+    if(root && !root->m_building)
+        ++root->m_paintStateEpoch;
+}
+
+void SvgNode::invalidateVarScopes() const
+{
+    SvgDocument* root = rootDocument();
+    if(root && !root->m_building)
+        ++root->m_varScopeEpoch;
+}
+
 void SvgNode::setDisplayMode(DisplayMode mode)
 {
-    const SvgAttr* attr = getAttr("display", SvgAttr::XMLSrc);
+    const SvgAttr* attr = getAttr(SvgAttr::DISPLAY, SvgAttr::XMLSrc);
     if(mode != BlockMode) {
         if(!attr || attr->intVal() != mode)
             setAttr("display", mode, SvgAttr::XMLSrc);
@@ -192,7 +359,7 @@ void SvgNode::setDisplayMode(DisplayMode mode)
 
 SvgNode::DisplayMode SvgNode::displayMode() const
 {
-    const SvgAttr* attr = getAttr("display", SvgAttr::XMLSrc);
+    const SvgAttr* attr = getAttr(SvgAttr::DISPLAY, SvgAttr::XMLSrc);
     return attr ? DisplayMode(attr->intVal()) : BlockMode;
 }
 
@@ -201,18 +368,36 @@ bool SvgNode::isVisible() const
     return m_visible && isPaintable();
 }
 
-bool SvgNode::hasClass(const char* s) const { return containsWord(m_class.c_str(), s); }
+bool SvgNode::hasClass(const char* s) const { return listContains(m_class.c_str(), s); }
 
 void SvgNode::setXmlClass(const char* str)
 {
     if(str != m_class) {
+        std::string oldclass = std::move(m_class);
         m_class = str;
-        restyle();
+        for(SvgDocument* doc = document(); doc; doc = doc->parent() ? doc->parent()->document() : NULL)
+            doc->updateNodeIndex(this, oldclass.c_str(), m_class.c_str());
+        restyleChanged('.', oldclass.c_str(), m_class.c_str());
     }
 }
 
-void SvgNode::addClass(const char* s) { setXmlClass(addWord(m_class, s).c_str()); }
-void SvgNode::removeClass(const char* s) { setXmlClass(removeWord(m_class, s).c_str()); }
+// class list is split w/ nextWord() here, as by CSS matching and the class index, so any whitespace separates
+void SvgNode::addClass(const char* s)
+{
+    if(!listContains(m_class.c_str(), s))
+        setXmlClass(m_class.empty() ? s : (m_class + " " + s).c_str());
+}
+
+void SvgNode::removeClass(const char* s)
+{
+    std::string cls;
+    const char* p = m_class.c_str();
+    for(StringRef word = nextWord(p); !word.isEmpty(); word = nextWord(p)) {
+        if(word != s)
+            cls.append(cls.empty() ? "" : " ").append(word.data(), word.size());
+    }
+    setXmlClass(cls.c_str());
+}
 
 void SvgNode::setXmlId(const char* id)
 {
@@ -221,10 +406,25 @@ void SvgNode::setXmlId(const char* id)
     SvgDocument* doc = m_parent ? m_parent->document() : document();  // handle the case where we are <svg>
     if(doc && !m_id.empty())
         doc->removeNamedNode(this);
+    std::string oldid = std::move(m_id);
     m_id = id;
     if(doc && !m_id.empty())
         doc->addNamedNode(this);
-    restyle();
+    invalidatePaintState();  // paint servers are found by id
+    restyleChanged('#', oldid.c_str(), m_id.c_str());
+}
+
+// restyle after change of id ('#') or class ('.') names; only restyles nodes whose matching rules might change
+void SvgNode::restyleChanged(char kind, const char* oldnames, const char* newnames)
+{
+#ifndef NO_DYNAMIC_STYLE
+    SvgDocument* doc = document();
+    int scope = doc ? doc->restyleScope(kind, oldnames, newnames) : 0;
+    if(scope & css_stylesheet::invalidate_subtree)
+        restyle();
+    else if(scope & css_stylesheet::invalidate_self)
+        SvgNode::restyle();
+#endif
 }
 
 // Previously, we set a flag, defering restyle until an attribute was requested.  However, restyle could
@@ -238,6 +438,7 @@ bool SvgNode::restyle()
     SvgDocument* doc = document();
     if(!doc || !doc->canRestyle())
         return false;
+    ++doc->m_restyleCount;
     // mark CSS attributes stale
     for(auto it = attrs.rbegin(); it != attrs.rend() && it->src() == SvgAttr::CSSSrc; ++it)
         it->setStale(true);
@@ -246,21 +447,55 @@ bool SvgNode::restyle()
     for(auto it = attrs.end(); it != attrs.begin() && (--it)->src() == SvgAttr::CSSSrc;) {
         if(it->isStale()) {
             // must erase before we call onAttrChange!
-            std::string name = it->name();
-            auto stdattr = it->stdAttr();
+            SvgAttr removed(std::move(*it));  // name may not be interned, so keep it alive
             it = attrs.erase(it);
-            onAttrChange(name.c_str(), stdattr);
+            updateStdAttrs(removed.stdAttr());
+            onAttrChange(removed.name(), removed.stdAttr());
         }
     }
     return true;
 #endif
 }
 
+// cached variable scopes of descendants are rebuilt if a CSS variable (--name) on a container changes
+void SvgNode::onVarChange(const char* name)
+{
+    SvgContainerNode* container = asContainerNode();
+    if(container && name[0] == '-' && name[1] == '-') {
+        ++container->m_varVersion;
+        invalidateVarScopes();
+    }
+}
+
+static bool attrAffectsBounds(SvgAttr::StdAttr stdattr)
+{
+    switch(stdattr) {
+        case SvgAttr::FONT_FAMILY:
+        case SvgAttr::FONT_SIZE:
+        case SvgAttr::FONT_STYLE:
+        case SvgAttr::FONT_VARIANT:
+        case SvgAttr::FONT_WEIGHT:
+        case SvgAttr::STROKE:
+        case SvgAttr::STROKE_LINECAP:
+        case SvgAttr::STROKE_LINEJOIN:
+        case SvgAttr::STROKE_MITERLIMIT:
+        case SvgAttr::STROKE_WIDTH:
+        case SvgAttr::TEXT_ANCHOR:
+        case SvgAttr::LETTER_SPACING:
+            return true;
+        default:
+            return false;
+    }
+}
+
 // node notifies ext of each attr change via onAttrChange() so it can update any cached values
 // - if cached values depend on multiple attributes, makes sense to set flag and recalc just before use
 // - if each cached value depends only on a single attribute, they can be recalculated as soon as it changes
 void SvgNode::onAttrChange(const char* name, SvgAttr::StdAttr stdattr)
 {
+    invalidatePaintState();
+    if(stdattr == SvgAttr::UNKNOWN)
+        onVarChange(name);
     // invalidating bounds of all children can be expensive, so only do so if necessary
     // if we wanted to be fancier, in container node we could keep track of number of total descendants and
     //  number of descendants w/ valid bounds (then we can stop descending if valid count = 0)
@@ -268,32 +503,20 @@ void SvgNode::onAttrChange(const char* name, SvgAttr::StdAttr stdattr)
         if(m_parent)
             m_parent->setDirty(PIXELS_DIRTY);
     }
+    else if(attrAffectsBounds(stdattr))
+        invalidate(true);  // bounds may have changed
     else {
         switch(stdattr) {
-            case SvgAttr::FONT_FAMILY:
-            case SvgAttr::FONT_SIZE:
-            case SvgAttr::FONT_STYLE:
-            case SvgAttr::FONT_VARIANT:
-            case SvgAttr::FONT_WEIGHT:
-            case SvgAttr::STROKE:
-            case SvgAttr::STROKE_LINECAP:
-            case SvgAttr::STROKE_LINEJOIN:
-            case SvgAttr::STROKE_MITERLIMIT:
-            case SvgAttr::STROKE_WIDTH:
-            case SvgAttr::TEXT_ANCHOR:
-            case SvgAttr::LETTER_SPACING:
-                invalidate(true);  // bounds may have changed
-                break;
             case SvgAttr::DISPLAY:
             case SvgAttr::VISIBILITY:
             {
-                int dispmode = getIntAttr("display", BlockMode);
+                int dispmode = getIntAttr(SvgAttr::DISPLAY, BlockMode);
                 // SvgPainter::calcDirtyRect() ignores AbsoluteMode nodes, so if we are switching a node from BlockMode,
                 //  we add bounds to parent's removedBounds to get correct dirty rect
                 if(stdattr == SvgAttr::DISPLAY && dispmode == AbsoluteMode && m_visible && m_parent->asContainerNode())
                     m_parent->asContainerNode()->m_removedBounds.rectUnion(m_renderedBounds);  //bounds());
 
-                bool vis = dispmode != NoneMode && getIntAttr("visibility", 1);
+                bool vis = dispmode != NoneMode && getIntAttr(SvgAttr::VISIBILITY, 1);
                 if(vis != m_visible) {
                     // exactly one of these invalidate() calls will be a no-op since visible will be false
                     invalidate(false);
@@ -328,9 +551,10 @@ bool SvgNode::setAttrHelper(const SvgAttr& attr)
     // if inline style (style=) src, insert before first CSS attr and remove any CSS w/ same name
     // if CSS src, replace CSS attr w/ same name or insert at end, unless inline style version exists
     // if XML src, insert after last XML attr (or at beginning)
+    m_stdAttrs |= 1u << attr.stdAttr();
     if(attr.src() == SvgAttr::XMLSrc) {
         for(auto it = attrs.begin(); it != attrs.end(); ++it) {
-            if(it->nameIs(attr.name()) && it->src() == SvgAttr::XMLSrc)
+            if(it->sameName(attr) && it->src() == SvgAttr::XMLSrc)
                 return replaceAttr(*it, attr);
             else if(it->src() != SvgAttr::XMLSrc) {
                 attrs.insert(it, attr);
@@ -342,7 +566,7 @@ bool SvgNode::setAttrHelper(const SvgAttr& attr)
     else if(attr.src() == SvgAttr::CSSSrc) {
         // note reverse order iteration
         for(auto it = attrs.rbegin(); it != attrs.rend() && it->src() != SvgAttr::XMLSrc; ++it) {
-            if(it->nameIs(attr.name())) {  // src is CSS or inline style
+            if(it->sameName(attr)) {  // src is CSS or inline style
                 // CSS rules are processed from high to low priority, so we only replace stale attributes
                 if(it->src() == SvgAttr::CSSSrc && it->isStale())
                     return replaceAttr(*it, attr);
@@ -354,13 +578,13 @@ bool SvgNode::setAttrHelper(const SvgAttr& attr)
     else if(attr.src() == SvgAttr::InlineStyleSrc) {
         auto it = attrs.begin();
         for(; it != attrs.end() && it->src() != SvgAttr::CSSSrc; ++it) {
-            if(it->nameIs(attr.name()) && it->src() == SvgAttr::InlineStyleSrc)
+            if(it->sameName(attr) && it->src() == SvgAttr::InlineStyleSrc)
                 return replaceAttr(*it, attr);  // if already present as inline style, can't be a CSSSrc version
         }
         it = attrs.insert(it, attr);
         // remove CSSSrc attr is present
         for(++it; it != attrs.end(); ++it) {
-            if(it->nameIs(attr.name()) && it->src() == SvgAttr::CSSSrc) {
+            if(it->sameName(attr) && it->src() == SvgAttr::CSSSrc) {
                 attrs.erase(it);
                 break;
             }
@@ -375,6 +599,34 @@ void SvgNode::setAttr(const SvgAttr& attr)
         onAttrChange(attr.name(), attr.stdAttr());
 }
 
+// each onAttrChange() walks up to the root, so for nodes w/o special handling, we invalidate once at the end
+void SvgNode::setAttrs(const std::vector<SvgAttr>& newattrs)
+{
+    if(type() == STOP || hasExt()) {
+        for(const SvgAttr& attr : newattrs)
+            setAttr(attr);
+        return;
+    }
+    invalidatePaintState();  // in case only non-standard attributes change
+    DirtyFlag dirty = NOT_DIRTY;
+    for(const SvgAttr& attr : newattrs) {
+        if(!setAttrHelper(attr))
+            continue;
+        if(attr.stdAttr() == SvgAttr::UNKNOWN) {
+            onVarChange(attr.name());
+            continue;
+        }
+        if(attr.stdAttr() == SvgAttr::DISPLAY || attr.stdAttr() == SvgAttr::VISIBILITY)
+            onAttrChange(attr.name(), attr.stdAttr());
+        else
+            dirty = std::max(dirty, attrAffectsBounds(attr.stdAttr()) ? BOUNDS_DIRTY : PIXELS_DIRTY);
+    }
+    if(dirty == BOUNDS_DIRTY)
+        invalidate(true);
+    else if(dirty == PIXELS_DIRTY)
+        setDirty(PIXELS_DIRTY);
+}
+
 void SvgNode::setAttribute(const char* name, const char* value, SvgAttr::Src src)
 {
     processAttribute(this, src, name, value);  // this will call setAttr
@@ -389,8 +641,22 @@ void SvgNode::removeAttr(const char* name, int src)
     size_t n = attrs.size();
     for(auto it = attrs.begin(); it != attrs.end();)
         it = it->nameIs(name) && (it->src() & src) ? attrs.erase(it) : ++it;
-    if(attrs.size() < n)
-        onAttrChange(name, SvgAttr::nameToStdAttr(name));  // this is OK for now since removeAttr is rarely used
+    if(attrs.size() < n) {
+        SvgAttr::StdAttr stdattr = SvgAttr::nameToStdAttr(name);  // this is OK for now since removeAttr is rarely used
+        updateStdAttrs(stdattr);
+        onAttrChange(name, stdattr);
+    }
+}
+
+void SvgNode::updateStdAttrs(SvgAttr::StdAttr stdattr)
+{
+    if(stdattr == SvgAttr::UNKNOWN)
+        return;
+    for(const SvgAttr& attr : attrs) {
+        if(attr.stdAttr() == stdattr)
+            return;
+    }
+    m_stdAttrs &= ~(1u << stdattr);
 }
 
 const SvgAttr* SvgNode::getAttr(const char* name, int src) const
@@ -426,6 +692,44 @@ const char* SvgNode::getStringAttr(const char* name, const char* dflt) const
     return attr && attr->valueIs(SvgAttr::StringVal) ? attr->stringVal() : dflt;
 }
 
+static_assert(SvgAttr::LETTER_SPACING < 32, "SvgNode::m_stdAttrs needs more bits");
+
+const SvgAttr* SvgNode::getAttr(SvgAttr::StdAttr stdattr, int src) const
+{
+    // most lookups are for attributes that aren't present
+    if(!hasStdAttr(stdattr))
+        return NULL;
+    for(auto it = attrs.rbegin(); it != attrs.rend(); ++it) {
+        if(it->stdAttr() == stdattr && (it->src() & src))
+            return &*it;
+    }
+    return NULL;
+}
+
+int SvgNode::getIntAttr(SvgAttr::StdAttr stdattr, int dflt) const
+{
+    const SvgAttr* attr = getAttr(stdattr);
+    return attr && attr->valueIs(SvgAttr::IntVal) ? attr->intVal() : dflt;
+}
+
+Color SvgNode::getColorAttr(SvgAttr::StdAttr stdattr, color_t dflt) const
+{
+    const SvgAttr* attr = getAttr(stdattr);
+    return attr && attr->valueIs(SvgAttr::ColorVal) ? attr->colorVal() : dflt;
+}
+
+float SvgNode::getFloatAttr(SvgAttr::StdAttr stdattr, float dflt) const
+{
+    const SvgAttr* attr = getAttr(stdattr);
+    return attr && attr->valueIs(SvgAttr::FloatVal) ? attr->floatVal() : dflt;
+}
+
+const char* SvgNode::getStringAttr(SvgAttr::StdAttr stdattr, const char* dflt) const
+{
+    const SvgAttr* attr = getAttr(stdattr);
+    return attr && attr->valueIs(SvgAttr::StringVal) ? attr->stringVal() : dflt;
+}
+
 // convert CSS style attrs to inline style attrs, e.g., to allow for insertion into another document; note that
 //  a CSS attr is not added to node if overriding inline style attr is present, so all we have to do is change
 //  flags on CSS attrs
@@ -502,8 +806,84 @@ SvgNode* SvgContainerNode::selectFirst(const char* selector) const
     return hits.empty() ? NULL : hits.front();
 }
 
-// TODO: support complex selectors using cssparser; to support parsed attributes, serialize node
-//  (or just style?) if selector uses attributes other than id and class
+// preorder traversal of container (incl. container itself)
+static std::vector<SvgNode*> traverseHits(const SvgContainerNode* container, size_t nhits,
+        const std::function<bool(SvgNode*)>& pred)
+{
+    std::vector<SvgNode*> hits;
+    std::vector<SvgNode*> stack = {const_cast<SvgContainerNode*>(container)};
+    while(!stack.empty() && hits.size() < nhits) {
+        SvgNode* node = stack.back();
+        stack.pop_back();
+        if(pred(node))
+            hits.push_back(node);
+        if(node->asContainerNode()) {
+            const SvgNodeList& children = node->asContainerNode()->children();
+            for(auto it = children.rbegin(); it != children.rend(); ++it)
+                stack.push_back(*it);
+        }
+    }
+    return hits;
+}
+
+// candidates from document's index that are inside container and satisfy pred, in document order; ordering
+//  candidates costs more per node than traversal, so we only do so if there are relatively few
+static std::vector<SvgNode*> indexedHits(const SvgContainerNode* container, SvgDocument* doc,
+        const std::unordered_set<SvgNode*>& candidates, size_t nhits, const std::function<bool(SvgNode*)>& pred)
+{
+    if(candidates.size()*64 > doc->m_indexedNodes)
+        return traverseHits(container, nhits, pred);
+    // chain of ancestors from below container down to node
+    std::vector< std::vector<SvgNode*> > chains;
+    std::unordered_map<const SvgNode*, size_t> siblingIdx;
+    for(SvgNode* node : candidates) {
+        std::vector<SvgNode*> chain;
+        SvgNode* n = node;
+        for(; n && n != container; n = n->parent())
+            chain.push_back(n);
+        if(n == container && pred(node)) {
+            for(SvgNode* a : chain)
+                siblingIdx.emplace(a, 0);
+            std::reverse(chain.begin(), chain.end());
+            chains.push_back(std::move(chain));
+        }
+    }
+    // get index among siblings for every node in chains, walking the children of each parent only once
+    std::unordered_set<const SvgNode*> walked;
+    for(const auto& chain : chains) {
+        for(const SvgNode* n : chain) {
+            const SvgContainerNode* parent = n->parent() ? n->parent()->asContainerNode() : NULL;
+            if(!parent || !walked.insert(parent).second)
+                continue;
+            size_t idx = 0;
+            for(SvgNode* child : parent->children()) {
+                auto it = siblingIdx.find(child);
+                if(it != siblingIdx.end())
+                    it->second = idx;
+                ++idx;
+            }
+        }
+    }
+    // sort by path of sibling indices from container; an ancestor comes before its descendants
+    std::vector< std::pair<std::vector<size_t>, SvgNode*> > keyed;
+    keyed.reserve(chains.size());
+    for(const auto& chain : chains) {
+        std::vector<size_t> path;
+        path.reserve(chain.size());
+        for(const SvgNode* n : chain)
+            path.push_back(siblingIdx[n]);
+        keyed.emplace_back(std::move(path), chain.empty() ? const_cast<SvgContainerNode*>(container) : chain.back());
+    }
+    std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    std::vector<SvgNode*> hits;
+    for(size_t ii = 0; ii < keyed.size() && ii < nhits; ++ii)
+        hits.push_back(keyed[ii].second);
+    return hits;
+}
+
+// selectors other than a single id, class, or tag are matched w/ CSS engine used for styling, so the same
+//  limitations apply (e.g. no attribute selectors, tags are lower case); document's class and type index
+//  is used to find candidates if possible
 std::vector<SvgNode*> SvgContainerNode::select(const char* selector, size_t nhits) const
 {
     if(!selector || !selector[0])
@@ -518,51 +898,65 @@ std::vector<SvgNode*> SvgContainerNode::select(const char* selector, size_t nhit
         }
         return {};
     }
+    SvgDocument* doc = document();
     if(selector[0] == '.' && isSingleIdent(selector+1)) {
-        std::vector<SvgNode*> hits;
-        std::function<void(SvgNode*)> selfn = [&selfn, &selector, &hits, nhits](SvgNode* node){
-            if(hits.size() >= nhits)
-                return;
-            if(node->hasClass(selector+1))
-                hits.push_back(node);
-            if(node->asContainerNode()) {
-                for(SvgNode* child : node->asContainerNode()->children())
-                    selfn(child);
-            }
+        auto pred = [selector](SvgNode* node){ return node->hasClass(selector+1); };
+        if(!doc)
+            return traverseHits(this, nhits, pred);
+        const std::unordered_set<SvgNode*>* nodes = doc->nodesWithClass(selector+1);
+        return nodes ? indexedHits(this, doc, *nodes, nhits, pred) : std::vector<SvgNode*>();
+    }
+    int typeId = isSingleIdent(selector) ? SvgNode::nameToType(selector) : -1;
+    if(typeId >= 0) {
+        // this seems to be the only place we need a hack to deal with <a>, whereas making <a> a separate
+        //  class would require additional checks in many places
+        auto pred = [typeId](SvgNode* node){
+            return node->type() == typeId || (typeId == A && node->type() == G && static_cast<SvgG*>(node)->groupType == A);
         };
-        selfn(const_cast<SvgContainerNode*>(this));
-        return hits;
-    }
-    if(isSingleIdent(selector)) {
-        for(size_t typeId = 0; typeId < SvgNode::NUM_NODE_TYPES; ++typeId) {
-            if(strcmp(selector, SvgNode::nodeNames[typeId]) == 0) {
-                std::vector<SvgNode*> hits;
-                std::function<void(SvgNode*)> selfn = [&selfn, typeId, &hits, nhits](SvgNode* node){
-                    if(hits.size() >= nhits)
-                        return;
-                    // this seems to be the only place we need a hack to deal with <a>, whereas making <a> a separate
-                    //  class would require additional checks in many places
-                    if(node->type() == typeId || (typeId == A && node->type() == G && static_cast<SvgG*>(node)->groupType == A))
-                        hits.push_back(node);
-                    if(node->asContainerNode()) {
-                        for(SvgNode* child : node->asContainerNode()->children())
-                            selfn(child);
-                    }
-                };
-                selfn(const_cast<SvgContainerNode*>(this));
-                return hits;
+        if(!doc)
+            return traverseHits(this, nhits, pred);
+        const std::unordered_set<SvgNode*>* nodes = doc->nodesOfType(typeId == A ? G : typeId);
+        return nodes ? indexedHits(this, doc, *nodes, nhits, pred) : std::vector<SvgNode*>();
+    }
+#ifndef NO_CSS
+    SvgCssStylesheet sheet;
+    sheet.parse_stylesheet((std::string(selector) + "{}").c_str());
+    if(!sheet.rules().empty()) {
+        sheet.sort_rules();
+        auto pred = [&sheet](SvgNode* node){ return sheet.matches(node); };
+        if(!doc)
+            return traverseHits(this, nhits, pred);
+        // candidates from index are only usable if every selector in list has a class or tag on the right
+        std::unordered_set<SvgNode*> candidates;
+        for(const css_rule& rule : sheet.rules()) {
+            const css_element_selector& right = rule.m_selector->m_right;
+            const std::unordered_set<SvgNode*>* nodes = NULL;
+            auto cls = std::find_if(right.m_attrs.begin(), right.m_attrs.end(), [](const css_attribute_selector& a){
+                return a.condition == select_equal && a.attribute == "class"; });
+            if(cls != right.m_attrs.end())
+                nodes = doc->nodesWithClass(cls->val);
+            else if(!right.m_tag.empty() && right.m_tag != "*") {
+                int type = SvgNode::nameToType(right.m_tag.c_str());
+                nodes = type >= 0 ? doc->nodesOfType(type) : NULL;
             }
+            else
+                return traverseHits(this, nhits, pred);
+            if(nodes)
+                candidates.insert(nodes->begin(), nodes->end());
         }
+        return indexedHits(this, doc, candidates, nhits, pred);
     }
-    PLATFORM_LOG("Invalid node selector - only simple selectors are supported in select(): %s", selector);
+#endif
+    PLATFORM_LOG("Invalid node selector: %s", selector);
     return {};
 }
 
+// ids inside a nested <svg> belong to the nested document (see setXmlId())
 static void addIds(SvgDocument* doc, SvgNode* node)
 {
     if(node->xmlId()[0])
         doc->addNamedNode(node);
-    if(node->asContainerNode()) {
+    if(node->asContainerNode() && (node->type() != SvgNode::DOC || node == doc)) {
         for(SvgNode* child : node->asContainerNode()->children())
             addIds(doc, child);
     }
@@ -572,24 +966,38 @@ static void removeIds(SvgDocument* doc, SvgNode* node)
 {
     if(node->xmlId()[0])
         doc->removeNamedNode(node);
-    if(node->asContainerNode()) {
+    if(node->asContainerNode() && (node->type() != SvgNode::DOC || node == doc)) {
         for(SvgNode* child : node->asContainerNode()->children())
             removeIds(doc, child);
     }
 }
 
+// cached state is validated against epochs of root document, so must be dropped when leaving the tree; states
+//  are only cached along with those of all ancestors, so we can stop at any container w/o a cached state
+static void clearCachedState(SvgNode* node)
+{
+    SvgContainerNode* container = node->asContainerNode();
+    if(!container || (!container->m_paintState && !container->m_varScope))
+        return;
+    container->m_paintState.reset();
+    container->m_varScope.reset();
+    for(SvgNode* child : container->children())
+        clearCachedState(child);
+}
+
 void SvgContainerNode::addChild(SvgNode* child, SvgNode* next)
 {
     child->invalidateBounds(true);
     child->m_renderedBounds = SVGRect();
     child->setParent(this);
+    invalidatePaintState();
+    invalidateVarScopes();
     child->m_dirty = NOT_DIRTY;  // ensure that parents will be marked CHILD_DIRTY
     child->setDirty(BOUNDS_DIRTY);
 
-    if(next)
-        children().insert(std::find(children().begin(), children().end(), next), child);
-    else
-        children().push_back(child);
+    children().insert(next && next->parent() == this ? next : NULL, child);
+    if(m_boundsIndex)
+        m_boundsIndex->invalidateAll();
     // invalidate bounds if necessary
     if(m_cachedBounds.isValid() && !m_cachedBounds.contains(child->bounds()))
         invalidateBounds(false);
@@ -598,13 +1006,14 @@ void SvgContainerNode::addChild(SvgNode* child, SvgNode* next)
     if(doc) {
         child->restyle();
         addIds(doc, child);
+        for(; doc; doc = doc->parent() ? doc->parent()->document() : NULL)
+            doc->indexSubtree(child, true);
     }
 }
 
 SvgNode* SvgContainerNode::removeChild(SvgNode* child)
 {
-    auto it = std::find(children().begin(), children().end(), child);
-    if(it == children().end())
+    if(!child || child->parent() != this)
         return NULL;
 
     if(m_renderedBounds.isValid())
@@ -621,9 +1030,15 @@ SvgNode* SvgContainerNode::removeChild(SvgNode* child)
     SvgDocument* doc = document();
     if(doc)
         removeIds(doc, child);
+    for(; doc; doc = doc->parent() ? doc->parent()->document() : NULL)
+        doc->indexSubtree(child, false);
     child->setParent(NULL);
-    auto next = children().erase(it);
-    return next != children().end() ? *next : NULL;
+    clearCachedState(child);
+    invalidatePaintState();
+    invalidateVarScopes();
+    if(m_boundsIndex)
+        m_boundsIndex->invalidateAll();
+    return children().erase(child);
 }
 
 // because CSS selectors can select children, we must restyle all children upon attribute change
@@ -641,31 +1056,233 @@ bool SvgContainerNode::restyle()
 // find top-most visual node under a point; excludes container nodes by default
 SvgNode* SvgContainerNode::nodeAt(const SVGPoint& p, bool visual_only) const
 {
+    auto hitTest = [&](SvgNode* node) -> SvgNode* {
+        if(!node->isVisible() || !node->bounds().contains(p))
+            return NULL;
+        return node->asContainerNode() ? node->asContainerNode()->nodeAt(p, visual_only) : node;
+    };
     // process children in top to bottom z-order
-    for(auto it = children().crbegin(); it != children().crend(); ++it) {
-        SvgNode* node = *it;
-        if(node->isVisible() && node->bounds().contains(p)) {
-            if(node->asContainerNode()) {
-                SvgNode* fromchild = node->asContainerNode()->nodeAt(p, visual_only);
-                if(fromchild)
-                    return fromchild;
-            }
-            else
-                return node;
+    const SvgBoundsIndex* index = boundsIndex();
+    if(index) {
+        std::vector<SvgNode*> hits;
+        index->query(SVGRect::ltrb(p.x, p.y, p.x, p.y), &hits);
+        for(auto it = hits.rbegin(); it != hits.rend(); ++it) {
+            if(SvgNode* hit = hitTest(*it))
+                return hit;
+        }
+    }
+    else {
+        for(auto it = children().crbegin(); it != children().crend(); ++it) {
+            if(SvgNode* hit = hitTest(*it))
+                return hit;
         }
     }
     return (visual_only || !bounds().contains(p)) ? NULL : const_cast<SvgContainerNode*>(this);
 }
 
+static void nodesInRect(const SvgContainerNode* container, const SVGRect& r, bool visual_only, std::vector<SvgNode*>* out)
+{
+    std::vector<SvgNode*> candidates;
+    const SvgBoundsIndex* index = container->boundsIndex();
+    if(index)
+        index->query(r, &candidates);
+    else
+        candidates.assign(container->children().begin(), container->children().end());
+    for(SvgNode* node : candidates) {
+        if(!node->isVisible() || !node->bounds().intersects(r))
+            continue;
+        if(node->asContainerNode()) {
+            if(!visual_only)
+                out->push_back(node);
+            nodesInRect(node->asContainerNode(), r, visual_only, out);
+        }
+        else
+            out->push_back(node);
+    }
+}
+
+// all nodes (in document order) whose bounds intersect r; excludes container nodes by default
+std::vector<SvgNode*> SvgContainerNode::nodesIn(const SVGRect& r, bool visual_only) const
+{
+    std::vector<SvgNode*> hits;
+    nodesInRect(this, r, visual_only, &hits);
+    return hits;
+}
+
+const SvgBoundsIndex* SvgContainerNode::boundsIndex() const
+{
+    if(children().size() < SvgBoundsIndex::MIN_CHILDREN) {
+        m_boundsIndex.reset();
+        return NULL;
+    }
+    if(!m_boundsIndex)
+        m_boundsIndex.reset(new SvgBoundsIndex(this));
+    return m_boundsIndex.get();
+}
+
+SvgContainerNode::~SvgContainerNode() {}
+
 void SvgContainerNode::invalidateBounds(bool inclChildren, bool inclParents) const
 {
     SvgNode::invalidateBounds(inclChildren, inclParents);
     if(inclChildren) {
+        if(m_boundsIndex)
+            m_boundsIndex->invalidateAll();
         for(SvgNode* node : children())
             node->invalidateBounds(true, false);
     }
 }
 
+// SvgBoundsIndex
+
+bool SvgBoundsIndex::isIndexed(const SvgNode* node) const
+{
+    return node->isVisible() && node->displayMode() != SvgNode::AbsoluteMode;
+}
+
+void SvgBoundsIndex::invalidate(const SvgNode* child)
+{
+    if(!m_valid)
+        return;
+    auto it = m_itemOf.find(child);
+    if(it == m_itemOf.end())
+        m_valid = false;
+    else if(!m_isStale[it->second]) {
+        m_isStale[it->second] = 1;
+        m_stale.push_back(it->second);
+    }
+}
+
+void SvgBoundsIndex::rebuild() const
+{
+    m_nodes.assign(m_container->children().begin(), m_container->children().end());
+    m_itemOf.clear();
+    for(size_t ii = 0; ii < m_nodes.size(); ++ii)
+        m_itemOf[m_nodes[ii]] = ii;
+    m_isStale.assign(m_nodes.size(), 0);
+    m_stale.clear();
+    m_refits = 0;
+    // calculating bounds can invalidate other children (e.g. <use> target), which will then be refit by update()
+    m_valid = true;
+    m_boxes.clear();
+    m_items.clear();
+    m_unindexed.clear();
+    for(size_t ii = 0; ii < m_nodes.size(); ++ii) {
+        m_boxes.push_back(isIndexed(m_nodes[ii]) ? m_nodes[ii]->bounds() : SVGRect());
+        // a child w/o valid bounds can still be drawn (e.g. if dirtyRect is huge), so it is always returned
+        if(m_boxes.back().isValid())
+            m_items.push_back(ii);
+        else
+            m_unindexed.push_back(ii);
+    }
+    m_leafOf.assign(m_nodes.size(), -1);
+    m_tree.clear();
+    m_tree.reserve(2*m_items.size()/LEAF_SIZE + 1);
+    if(!m_items.empty())
+        build(-1, 0, m_items.size());
+}
+
+// top-down median split along longer axis of box centers
+int SvgBoundsIndex::build(int parent, int start, int end) const
+{
+    int id = m_tree.size();
+    m_tree.push_back({SVGRect(), parent, -1, -1, start, 0});
+    SVGRect box, centers;
+    for(int ii = start; ii < end; ++ii) {
+        box.rectUnion(m_boxes[m_items[ii]]);
+        centers.rectUnion(m_boxes[m_items[ii]].center());
+    }
+    m_tree[id].box = box;
+    if(end - start <= LEAF_SIZE) {
+        m_tree[id].count = end - start;
+        for(int ii = start; ii < end; ++ii)
+            m_leafOf[m_items[ii]] = id;
+        return id;
+    }
+    int mid = (start + end)/2;
+    bool xsplit = centers.width() >= centers.height();
+    std::nth_element(m_items.begin() + start, m_items.begin() + mid, m_items.begin() + end, [&](int a, int b) {
+        return xsplit ? m_boxes[a].left + m_boxes[a].right < m_boxes[b].left + m_boxes[b].right
+            : m_boxes[a].top + m_boxes[a].bottom < m_boxes[b].top + m_boxes[b].bottom;
+    });
+    int left = build(id, start, mid);
+    int right = build(id, mid, end);
+    m_tree[id].left = left;
+    m_tree[id].right = right;
+    return id;
+}
+
+// recalculate boxes from leaf containing item up to root; tree quality degrades if boxes move a lot, so update()
+//  periodically rebuilds instead
+void SvgBoundsIndex::refit(int item) const
+{
+    int id = m_leafOf[item];
+    SVGRect box;
+    for(int ii = m_tree[id].start; ii < m_tree[id].start + m_tree[id].count; ++ii)
+        box.rectUnion(m_boxes[m_items[ii]]);
+    m_tree[id].box = box;
+    for(id = m_tree[id].parent; id >= 0; id = m_tree[id].parent) {
+        box = m_tree[m_tree[id].left].box.united(m_tree[m_tree[id].right].box);
+        if(box == m_tree[id].box)
+            break;
+        m_tree[id].box = box;
+    }
+}
+
+void SvgBoundsIndex::update() const
+{
+    // children are normally added and removed via addChild() and removeChild(), which invalidate us
+    if(!m_valid || m_nodes.size() != m_container->children().size() || m_stale.size() > m_nodes.size()/8
+            || m_refits > m_nodes.size())
+        rebuild();
+    for(size_t ii = 0; ii < m_stale.size(); ++ii) {
+        int item = m_stale[ii];
+        const SvgNode* node = m_nodes[item];
+        SVGRect b = isIndexed(node) ? node->bounds() : SVGRect();
+        // moving between indexed and unindexed requires rebuild
+        if(b.isValid() != (m_leafOf[item] >= 0)) {
+            rebuild();
+            return;
+        }
+        m_boxes[item] = b;
+        m_isStale[item] = 0;
+        if(m_leafOf[item] >= 0)
+            refit(item);
+        ++m_refits;
+    }
+    m_stale.clear();
+}
+
+void SvgBoundsIndex::query(const SVGRect& r, std::vector<SvgNode*>* hits) const
+{
+    update();
+    std::vector<int> found(m_unindexed);
+    if(!m_tree.empty()) {
+        int stack[64];
+        int depth = 0;
+        stack[depth++] = 0;
+        while(depth > 0) {
+            const BVHNode& node = m_tree[stack[--depth]];
+            if(!node.box.overlaps(r))
+                continue;
+            if(node.count > 0) {
+                for(int ii = node.start; ii < node.start + node.count; ++ii) {
+                    if(m_boxes[m_items[ii]].overlaps(r))
+                        found.push_back(m_items[ii]);
+                }
+            }
+            else {
+                stack[depth++] = node.right;
+                stack[depth++] = node.left;
+            }
+        }
+    }
+    std::sort(found.begin(), found.end());
+    hits->reserve(hits->size() + found.size());
+    for(int idx : found)
+        hits->push_back(m_nodes[idx]);
+}
+
 SvgPattern::SvgPattern(real x, real y, real w, real h, Units_t pu, Units_t pcu)
 : m_cell(SVGRect::ltwh(x, y, w, h)), m_patternUnits(pu), m_patternContentUnits(pcu) {}
 
@@ -702,10 +1319,10 @@ Gradient& SvgGradient::gradient() const
         real offset = 0;
         for(SvgGradientStop* child : stops()) {
             SvgGradientStop* svgstop = static_cast<SvgGradientStop*>(child);
-            offset = std::min(std::max((real)svgstop->getFloatAttr("offset", 0), offset), 1.0);
-            Color color = svgstop->getColorAttr("stop-color", Color::BLACK);
+            offset = std::min(std::max((real)svgstop->getFloatAttr(SvgAttr::OFFSET, 0), offset), real(1));
+            Color color = svgstop->getColorAttr(SvgAttr::STOP_COLOR, Color::BLACK);
             // support stop-color w/ alpha < 1
-            color.setAlphaF(color.alphaF() * svgstop->getFloatAttr("stop-opacity", 1.0));
+            color.setAlphaF(color.alphaF() * svgstop->getFloatAttr(SvgAttr::STOP_OPACITY, 1.0));
             m_gradient.setColorAt(offset, color);
         }
     }
@@ -730,16 +1347,20 @@ SvgDocument* SvgDocument::clone() const
         c->m_namedNodes.clear();
         addIds(c, c);
     }
+    c->m_classIndex.clear();
+    c->m_typeIndex.clear();
+    c->m_indexedNodes = 0;
+    c->m_hasNodeIndex = false;
     return c;
 }
 
 // note that newid must include leading '#'
 static void replaceId(SvgNode* node, const char* oldid, const char* newid)
 {
-    const char* fillref = node->getStringAttr("fill");
+    const char* fillref = node->getStringAttr(SvgAttr::FILL);
     if(fillref && strcmp(fillref+1, oldid) == 0)
         node->setAttr("fill", newid);
-    const char* strokeref = node->getStringAttr("stroke");
+    const char* strokeref = node->getStringAttr(SvgAttr::STROKE);
     if(strokeref && strcmp(strokeref+1, oldid) == 0)
         node->setAttr("stroke", newid);
     const char* href = node->getStringAttr("xlink:href");  // we should do "href" too
@@ -777,15 +1398,19 @@ void SvgDocument::replaceIds(SvgDocument* dest)
 
 void SvgDocument::setWidth(const SvgLength& w)
 {
-    if(w != m_width)  //&& (w.isPercent() || m_width.isPercent() || m_viewBox.isValid()))
+    if(w != m_width) {  //&& (w.isPercent() || m_width.isPercent() || m_viewBox.isValid()))
         invalidate(m_viewBox.isValid());
+        invalidatePaintState();
+    }
     m_width = w;
 }
 
 void SvgDocument::setHeight(const SvgLength& h)
 {
-    if(h != m_height)  //&& (h.isPercent() || m_height.isPercent() || m_viewBox.isValid()))
+    if(h != m_height) {  //&& (h.isPercent() || m_height.isPercent() || m_viewBox.isValid()))
         invalidate(m_viewBox.isValid());
+        invalidatePaintState();
+    }
     m_height = h;
 }
 
@@ -795,8 +1420,10 @@ void SvgDocument::setUseSize(real w, real h)
     SvgLength oldw = width(), oldh = height();
     m_useWidth = w;
     m_useHeight = h;
-    if(width() != oldw || height() != oldh)
+    if(width() != oldw || height() != oldh) {
         invalidateBounds(true);  // clear cached bounds but do not set as dirty!   invalidate(m_viewBox.isValid());
+        invalidatePaintState();
+    }
 }
 
 SVGRect SvgDocument::viewportRect() const
@@ -836,6 +1463,7 @@ Transform2D SvgDocument::viewBoxTransform() const
 void SvgDocument::addSvgFont(SvgFont* font)
 {
     m_fonts.emplace(font->familyName(), font);
+    invalidatePaintState();
 }
 
 SvgFont* SvgDocument::svgFont(const char* family, int weight, Painter::FontStyle style) const
@@ -845,8 +1473,8 @@ SvgFont* SvgDocument::svgFont(const char* family, int weight, Painter::FontStyle
     if(std::distance(hits.first, hits.second) == 1)
         return const_cast<SvgFont*>(hits.first->second);
     for(auto hit = hits.first; hit != hits.second; ++hit) {
-        if(hit->second->fontFace()->getIntAttr("font-weight", 400) == weight
-           && hit->second->fontFace()->getIntAttr("font-style", Painter::StyleNormal) == style)
+        if(hit->second->fontFace()->getIntAttr(SvgAttr::FONT_WEIGHT, 400) == weight
+           && hit->second->fontFace()->getIntAttr(SvgAttr::FONT_STYLE, Painter::StyleNormal) == style)
             return const_cast<SvgFont*>(hit->second);
     }
     if(hits.first != hits.second)
@@ -884,6 +1512,68 @@ SvgNode* SvgDocument::namedNode(const char* id) const
     return it != m_namedNodes.end() ? it->second : NULL;
 }
 
+static void buildNodeIndex(SvgDocument* doc)
+{
+    if(!doc->m_hasNodeIndex) {
+        doc->m_hasNodeIndex = true;
+        doc->indexSubtree(doc, true);
+    }
+}
+
+const std::unordered_set<SvgNode*>* SvgDocument::nodesWithClass(const std::string& cls)
+{
+    buildNodeIndex(this);
+    auto it = m_classIndex.find(cls);
+    return it != m_classIndex.end() ? &it->second : NULL;
+}
+
+const std::unordered_set<SvgNode*>* SvgDocument::nodesOfType(int type)
+{
+    buildNodeIndex(this);
+    auto it = m_typeIndex.find(type);
+    return it != m_typeIndex.end() ? &it->second : NULL;
+}
+
+void SvgDocument::updateNodeIndex(SvgNode* node, const char* oldclass, const char* newclass)
+{
+    if(!m_hasNodeIndex)
+        return;
+    for(StringRef name = nextWord(oldclass); !name.isEmpty(); name = nextWord(oldclass)) {
+        auto it = m_classIndex.find(name.toString());
+        if(it != m_classIndex.end()) {
+            it->second.erase(node);
+            if(it->second.empty())
+                m_classIndex.erase(it);
+        }
+    }
+    for(StringRef name = nextWord(newclass); !name.isEmpty(); name = nextWord(newclass))
+        m_classIndex[name.toString()].insert(node);
+}
+
+// unlike ids, nodes of nested documents are included since select() descends into them
+void SvgDocument::indexSubtree(SvgNode* node, bool add)
+{
+    if(!m_hasNodeIndex)
+        return;
+    if(add) {
+        updateNodeIndex(node, "", node->xmlClass());
+        m_indexedNodes += m_typeIndex[node->type()].insert(node).second;
+    }
+    else {
+        updateNodeIndex(node, node->xmlClass(), "");
+        auto it = m_typeIndex.find(node->type());
+        if(it != m_typeIndex.end()) {
+            m_indexedNodes -= it->second.erase(node);
+            if(it->second.empty())
+                m_typeIndex.erase(it);
+        }
+    }
+    if(node->asContainerNode()) {
+        for(SvgNode* child : node->asContainerNode()->children())
+            indexSubtree(child, add);
+    }
+}
+
 #ifndef NO_DYNAMIC_STYLE
 SvgDocument::~SvgDocument() { if(m_stylesheet) delete m_stylesheet; }
 // caller should call restyle() after setting stylesheet (after adding styles and calling sort_rules())
@@ -905,6 +1595,33 @@ void SvgDocument::restyleNode(SvgNode* node)
 #endif
 }
 
+// id is a single name, class a space separated list; combines invalidation for names added and removed
+int SvgDocument::restyleScope(char kind, const char* oldnames, const char* newnames)
+{
+    int scope = 0;
+#ifndef NO_DYNAMIC_STYLE
+    SvgDocument* parent_doc;
+    if(m_parent && (parent_doc = m_parent->document()))
+        scope = parent_doc->restyleScope(kind, oldnames, newnames);
+    if(!m_stylesheet || m_stylesheet->rules().empty())
+        return scope;
+    auto addScope = [&](const char* names, const char* other) {
+        if(kind != '.') {
+            if(names[0] && strcmp(names, other) != 0)
+                scope |= m_stylesheet->invalidation(kind, names, strlen(names));
+            return;
+        }
+        for(StringRef name = nextWord(names); !name.isEmpty(); name = nextWord(names)) {
+            if(!listContains(other, name))
+                scope |= m_stylesheet->invalidation(kind, name.data(), name.size());
+        }
+    };
+    addScope(oldnames, newnames);
+    addScope(newnames, oldnames);
+#endif
+    return scope;
+}
+
 bool SvgDocument::canRestyle()
 {
 #ifndef NO_DYNAMIC_STYLE
@@ -918,13 +1635,78 @@ bool SvgDocument::canRestyle()
 SvgImage::SvgImage(Image image, const SVGRect& bounds, const char* linkStr)
 : m_image(std::move(image)), m_bounds(bounds), m_linkStr(linkStr ? linkStr : "") {}
 
-SvgImage::SvgImage(const SvgImage& other) : SvgNode(other), m_image(other.m_image.copy()),
-m_bounds(other.m_bounds), m_linkStr(other.m_linkStr), srcRect(other.srcRect) {}
+SvgImage::SvgImage(std::string dataUri, const SVGRect& bounds)
+: m_image(Image(0, 0)), m_bounds(bounds), m_dataUri(std::move(dataUri)), m_decoded(false) {}
+
+// decoded pixels are shared (copy-on-write); if image hasn't been decoded yet, clone will decode separately
+SvgImage::SvgImage(const SvgImage& other) : SvgNode(other),
+m_image(other.m_decoded ? other.m_image : cow_ptr<Image>(Image(0, 0))), m_bounds(other.m_bounds),
+m_linkStr(other.m_linkStr), m_dataUri(other.m_dataUri), srcRect(other.srcRect), m_decoded(other.m_decoded),
+m_imgWidth(other.m_imgWidth), m_imgHeight(other.m_imgHeight) {}
+
+std::vector<unsigned char> SvgImage::decodeDataUri() const
+{
+    size_t b64 = m_dataUri.find("base64,");
+    if(b64 == std::string::npos)
+        return {};
+    return base64_decode(m_dataUri.data() + b64 + 7, m_dataUri.size() - b64 - 7);
+}
+
+void SvgImage::decode() const
+{
+    if(m_decoded)
+        return;
+    m_decoded = true;
+    auto dec64 = decodeDataUri();
+    const Image& img = m_image.reset(Image::decodeBuffer(dec64.data(), dec64.size()));
+    if(img.width <= 0 || img.height <= 0)
+        PLATFORM_LOG("Error decoding inline image\n");
+}
+
+// viewport, etc. only need image size, which we can get from header, so only start of data is decoded; PNG
+//  header is in first 33 bytes, but JPEG metadata (EXIF, etc.) can precede frame header, so prefix is enlarged
+//  a couple of times before falling back to decoding the whole image
+void SvgImage::decodeSize() const
+{
+    if(m_imgWidth >= 0)
+        return;
+    size_t b64 = m_dataUri.find("base64,");
+    if(b64 != std::string::npos) {
+        const char* data = m_dataUri.data() + b64 + 7;
+        size_t len = m_dataUri.size() - b64 - 7;
+        for(size_t n = 512; n <= 128*1024; n *= 16) {
+            auto header = base64_decode(data, std::min(n, len));
+            if(Image::decodeSize(header.data(), header.size(), &m_imgWidth, &m_imgHeight))
+                return;
+            if(n >= len)
+                break;
+        }
+    }
+    decode();
+    m_imgWidth = m_image->width;
+    m_imgHeight = m_image->height;
+}
+
+int SvgImage::imageWidth() const
+{
+    if(m_decoded)
+        return m_image->width;
+    decodeSize();
+    return m_imgWidth;
+}
+
+int SvgImage::imageHeight() const
+{
+    if(m_decoded)
+        return m_image->height;
+    decodeSize();
+    return m_imgHeight;
+}
 
 SVGRect SvgImage::viewport() const
 {
     real w = m_bounds.width(), h = m_bounds.height();
-    real imgw = m_image.getWidth(), imgh = m_image.getHeight();
+    real imgw = imageWidth(), imgh = imageHeight();
     if(w > 0 && h > 0)
         return m_bounds;
     if(w <= 0 && h <= 0)
@@ -958,7 +1740,9 @@ void SvgRect::setRect(const SVGRect& rect, real rx, real ry)
 
 void SvgRect::updatePath()
 {
-    m_path.clear();
+    // path is about to be overwritten, so no need to copy if shared
+    Path2D& path = m_path.shared() ? m_path.reset() : m_path.mut();
+    path.clear();
     if(m_rect.width() <= 0 || m_rect.height() <= 0)
         return;  // SVG spec says <rect> width or height == 0 disables rendering
     if(m_rx > 0 || m_ry > 0) {
@@ -969,18 +1753,18 @@ void SvgRect::updatePath()
         real rxx2 = std::min(m_rx, w/2);
         real ryy2 = std::min(m_ry, h/2);
 
-        m_path.moveTo(x, y+ryy2);
-        m_path.addArc(x+rxx2, y+ryy2, rxx2, ryy2, M_PI, M_PI/2);
-        m_path.lineTo(x+w-rxx2, y);
-        m_path.addArc(x+w-rxx2, y+ryy2, rxx2, ryy2, -M_PI/2, M_PI/2);
-        m_path.lineTo(x+w, y+h-ryy2);
-        m_path.addArc(x+w-rxx2, y+h-ryy2, rxx2, ryy2, 0, M_PI/2);
-        m_path.lineTo(x+rxx2, y+h);
-        m_path.addArc(x+rxx2, y+h-ryy2, rxx2, ryy2, M_PI/2, M_PI/2);
-        m_path.closeSubpath();
+        path.moveTo(x, y+ryy2);
+        path.addArc(x+rxx2, y+ryy2, rxx2, ryy2, M_PI, M_PI/2);
+        path.lineTo(x+w-rxx2, y);
+        path.addArc(x+w-rxx2, y+ryy2, rxx2, ryy2, -M_PI/2, M_PI/2);
+        path.lineTo(x+w, y+h-ryy2);
+        path.addArc(x+w-rxx2, y+h-ryy2, rxx2, ryy2, 0, M_PI/2);
+        path.lineTo(x+rxx2, y+h);
+        path.addArc(x+rxx2, y+h-ryy2, rxx2, ryy2, M_PI/2, M_PI/2);
+        path.closeSubpath();
     }
     else
-        m_path.addRect(m_rect);
+        path.addRect(m_rect);
 }
 
 // if <use> refers to external document, it should be passed as doc and will be deleted when SvgUse is
@@ -2,8 +2,10 @@
 
 #include <string>
 #include <memory>
-#include <list>
+#include <iterator>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
 #include "ulib/path2d.hxx"
 #include "ulib/image.hxx"
 #include "ulib/painter.hxx"  // for Color and Gradient
@@ -18,6 +20,8 @@ class SvgContainerNode;
 class SvgDocument;
 class SvgPainter;
 class SvgWriter;
+struct SvgPaintState;
+struct SvgVarScope;
 
 class SvgAttr
 {
@@ -27,7 +31,13 @@ public:
         STROKE_DASHARRAY, STROKE_DASHOFFSET, STROKE_LINECAP, STROKE_LINEJOIN, STROKE_MITERLIMIT, STROKE_OPACITY,
         STROKE_WIDTH, TEXT_ANCHOR, VECTOR_EFFECT, VISIBILITY, LETTER_SPACING };
 
-    static StdAttr nameToStdAttr(const char* name);
+    static StdAttr nameToStdAttr(const char* name) { return nameToStdAttr(name, strlen(name)); }
+    static StdAttr nameToStdAttr(const char* name, size_t len);
+    static const char* stdAttrName(StdAttr stdattr);
+    // standard and other known SVG attribute names are interned: same pointer is returned for equal names and
+    //  is valid for life of program; returns NULL for any other name, which each SvgAttr stores itself (shared
+    //  w/ copies), so that arbitrary names from untrusted documents are not kept around forever
+    static const char* internName(const char* name);
 
     enum { Stale = 0x10000, NoSerialize = 0x20000, Variable = 0x40000 };
     bool isStale() const { return flags & Stale; }
@@ -37,12 +47,15 @@ public:
     Src src() const { return Src(flags & 0xF000); }
     StdAttr stdAttr() const { return StdAttr(flags & 0xFF); }
     // note this only sets src and StdAttr
-    SvgAttr& setFlags(unsigned int f) { flags = f | valueType(); return *this; }
+    SvgAttr& setFlags(unsigned int f) { flags = (f & ~OwnedName) | valueType() | (flags & OwnedName); return *this; }
     unsigned int getFlags() const { return flags; }
 
-    const char* name() const { return str.c_str(); }
-    bool nameIs(const char* s) const { return strcmp(name(), s) == 0; }
+    const char* name() const { return m_name; }
+    bool nameIs(const char* s) const { return m_name == s || strcmp(m_name, s) == 0; }
     bool nameIs(StdAttr std) const { return stdAttr() == std; }
+    // known names are interned, so only names owned by both attrs need to be compared
+    bool sameName(const SvgAttr& other) const
+    { return m_name == other.m_name || ((flags & other.flags & OwnedName) && strcmp(m_name, other.m_name) == 0); }
 
     enum ValueType { IntVal = 0x100, ColorVal = 0x200, FloatVal = 0x300, StringVal = 0x400 };
     ValueType valueType() const { return ValueType(flags & 0x0F00); }
@@ -52,31 +65,58 @@ public:
     int intVal() const { return value.intVal; }
     color_t colorVal() const { return value.colorVal; }
     float floatVal() const { return value.floatVal; }
-    const char* stringVal() const { return str.data() + value.strOffset; }
-    size_t stringLen() const { return str.size() - value.strOffset; }
-
-    SvgAttr(const char* n, int v, int f = XMLSrc) : str(n), flags(f | IntVal) { value.intVal = v; }
-    SvgAttr(const char* n, color_t v, int f = XMLSrc) : str(n), flags(f | ColorVal) { value.colorVal = v; }
-    SvgAttr(const char* n, float v, int f = XMLSrc) : str(n), flags(f | FloatVal) { value.floatVal = v; }
-    SvgAttr(const char* n, double v, int f = XMLSrc) : str(n), flags(f | FloatVal) { value.floatVal = v; }
-    //SvgAttr(const char* n, void* v, int f = XMLSrc) : str(n), flags(f | PtrVal) { value.ptrVal = v; }
-    SvgAttr(const char* n, const char* v, int f = XMLSrc) : str(n), flags(f | StringVal)
-    { str += '\0';  value.strOffset = str.size();  str += v; }
+    const char* stringVal() const { return value.strVal ? value.strVal->data : ""; }
+    size_t stringLen() const { return value.strVal ? value.strVal->len : 0; }
+
+    SvgAttr(const char* n, int v, int f = XMLSrc) : flags(f | IntVal) { initName(n); value.intVal = v; }
+    SvgAttr(const char* n, color_t v, int f = XMLSrc) : flags(f | ColorVal) { initName(n); value.colorVal = v; }
+    SvgAttr(const char* n, float v, int f = XMLSrc) : flags(f | FloatVal) { initName(n); value.floatVal = v; }
+    SvgAttr(const char* n, double v, int f = XMLSrc) : flags(f | FloatVal) { initName(n); value.floatVal = v; }
+    SvgAttr(const char* n, const char* v, int f = XMLSrc) : flags(f | StringVal)
+    { initName(n); value.strVal = SharedStr::create(v, strlen(v)); }
     // Previously, we made hack of storing arbitrary data in str official but this is dangerous because we
     //  can't guarantee proper alignment - so we'll force the only use case, stroke-dasharray, to use
     //  stringVal to make 1-byte alignment explicit
-    SvgAttr(const char* n, const void* v, size_t len, int f = XMLSrc) : str(n), flags(f | StringVal)
-    { str += '\0';  value.strOffset = str.size();  str.append((const char*)v, len); }
+    SvgAttr(const char* n, const void* v, size_t len, int f = XMLSrc) : flags(f | StringVal)
+    { initName(n); value.strVal = SharedStr::create((const char*)v, len); }
+
+    SvgAttr(const SvgAttr& other) : m_name(other.m_name), value(other.value), flags(other.flags)
+    {
+        if(valueIs(StringVal)) SharedStr::retain(value.strVal);
+        if(flags & OwnedName) SharedStr::retain(nameStr());
+    }
+    SvgAttr(SvgAttr&& other) noexcept : m_name(other.m_name), value(other.value), flags(other.flags)
+    { other.flags = IntVal; }
+    SvgAttr& operator=(const SvgAttr& other);
+    SvgAttr& operator=(SvgAttr&& other) noexcept;
+    ~SvgAttr()
+    {
+        if(valueIs(StringVal)) SharedStr::release(value.strVal);
+        if(flags & OwnedName) SharedStr::release(nameStr());
+    }
 
 private:
-    // str stores name and, if present, string value; std::string is 24-32 bytes, char* is 8 bytes, so not much
-    //  benefit to deduping name; for Write, path data completely dominates svg memory use
-    std::string str;
+    // string values are immutable, so copies (e.g. CSS attrs applied to many nodes) can share them
+    struct SharedStr {
+        std::atomic<int> refs;
+        size_t len;
+        char data[1];
+
+        static SharedStr* create(const char* s, size_t len);
+        static void retain(SharedStr* str) { if(str) ++str->refs; }
+        static void release(SharedStr* str) { if(str && --str->refs == 0) free(str); }
+    };
+
+    enum { OwnedName = 0x80000 };  // m_name is data of a SharedStr instead of an interned name
+    SharedStr* nameStr() const { return (SharedStr*)(m_name - offsetof(SharedStr, data)); }
+    void initName(const char* name);
+
+    const char* m_name;
     union {
         int intVal;
         color_t colorVal;
         float floatVal;
-        unsigned int strOffset;
+        SharedStr* strVal;
     } value;
     unsigned int flags;  // source (XML, CSS, style=), value type, standard attribute id
 };
@@ -124,7 +164,6 @@ protected:
     SvgNodeExtension(const SvgNodeExtension&) = default;
 };
 
-
 class SvgNode
 {
 public:
@@ -133,6 +172,7 @@ public:
 
     static const int NUM_NODE_TYPES = CUSTOM+1;
     static const char* nodeNames[];
+    static int nameToType(const char* name);  // returns -1 if name is not in nodeNames
     static Transform2D identityTransform;
 
     static std::string nodePath(const SvgNode* node);  // for debugging - should probably be non-static
@@ -146,8 +186,14 @@ public:
 
     SvgNode* parent() const { return m_parent; }
     void setParent(SvgNode* parent) { m_parent = parent; }
+    SvgNode* nextSibling() const { return m_nextSibling; }
+    SvgNode* prevSibling() const { return m_prevSibling; }
     SvgDocument* document() const;
     SvgDocument* rootDocument() const;
+    // call for any change that could affect inherited painter state cached for SvgPainter
+    void invalidatePaintState() const;
+    // call when a CSS variable is set on a container or tree changes; see SvgCssStylesheet::varScope()
+    void invalidateVarScopes() const;
 
     virtual Type type() const = 0;
     virtual SvgNode* clone() const = 0;
@@ -166,6 +212,7 @@ public:
     void invalidate(bool children) const;
     virtual void invalidateBounds(bool inclChildren, bool inclParents = true) const;
     virtual bool restyle();
+    void restyleChanged(char kind, const char* oldnames, const char* newnames);
     void setDirty(DirtyFlag type) const;
 
     void setDisplayMode(DisplayMode display);
@@ -184,6 +231,8 @@ public:
     // attributes
     void setAttribute(const char* name, const char* value, SvgAttr::Src src = SvgAttr::XMLSrc);
     void setAttr(const SvgAttr& attr);
+    // set several attributes (e.g. computed CSS style) w/ a single invalidation of node
+    void setAttrs(const std::vector<SvgAttr>& newattrs);
     template<typename T>
     void setAttr(const char* name, T val, SvgAttr::Src src = SvgAttr::XMLSrc)
     { setAttr(SvgAttr( name, val, src | SvgAttr::nameToStdAttr(name) )); }
@@ -194,6 +243,13 @@ public:
     Color getColorAttr(const char* name, color_t dflt = Color::INVALID_COLOR) const;
     float getFloatAttr(const char* name, float dflt = NAN) const;
     const char* getStringAttr(const char* name, const char* dflt = NULL) const;
+    // faster versions for standard attributes
+    bool hasStdAttr(SvgAttr::StdAttr stdattr) const { return m_stdAttrs & (1u << stdattr); }
+    const SvgAttr* getAttr(SvgAttr::StdAttr stdattr, int src = SvgAttr::AnySrc) const;
+    int getIntAttr(SvgAttr::StdAttr stdattr, int dflt = INT_MIN) const;
+    Color getColorAttr(SvgAttr::StdAttr stdattr, color_t dflt = Color::INVALID_COLOR) const;
+    float getFloatAttr(SvgAttr::StdAttr stdattr, float dflt = NAN) const;
+    const char* getStringAttr(SvgAttr::StdAttr stdattr, const char* dflt = NULL) const;
     SvgNode* getRefTarget(const char* id) const;
     void cssToInlineStyle();
 
@@ -207,9 +263,13 @@ protected:
 
     bool setAttrHelper(const SvgAttr& attr);
     void onAttrChange(const char* name, SvgAttr::StdAttr stdattr);
+    void updateStdAttrs(SvgAttr::StdAttr stdattr);
+    void onVarChange(const char* name);
 
 public:
+    // use setAttr()/removeAttr() to add or remove attributes so that m_stdAttrs is updated
     std::vector<SvgAttr> attrs;
+    unsigned int m_stdAttrs = 0;  // bit (1 << StdAttr) is set if attrs contains a standard attribute
     std::unique_ptr<Transform2D> transform;  // prior to SVG 2, transform is not a presentation attribute
 
     //private:
@@ -218,6 +278,8 @@ public:
     mutable DirtyFlag m_dirty = NOT_DIRTY;
 
     SvgNode* m_parent = NULL;
+    SvgNode* m_nextSibling = NULL;  // links for parent's SvgNodeList
+    SvgNode* m_prevSibling = NULL;
     std::unique_ptr<SvgNodeExtension> m_ext;
     bool m_visible = true;
     std::string m_id;
@@ -227,9 +289,9 @@ public:
 class SvgXmlFragment : public SvgNode
 {
 public:
-    std::unique_ptr<XmlFragment> fragment;
+    // fragment is never modified, so it is shared with clones
+    std::shared_ptr<const XmlFragment> fragment;
     SvgXmlFragment(XmlFragment* frag) : fragment(frag) {}
-    SvgXmlFragment(const SvgXmlFragment& other) : SvgNode(other), fragment(other.fragment->clone()) {}
     Type type() const override { return UNKNOWN; }
     SvgXmlFragment* clone() const override { return new SvgXmlFragment(*this); }
 };
@@ -252,7 +314,7 @@ struct cloning_container
     cloning_container(const cloning_container& other) = delete;
     cloning_container(SvgNode* newparent, const cloning_container& other)
     {
-        //c.reserve(other.c.size()); -- not avail for list
+        c.reserve(other.c.size());
         for(auto& ptr : other.c) {
             c.push_back(ptr->clone());
             c.back()->setParent(newparent);
@@ -263,12 +325,163 @@ struct cloning_container
     const T& get() const { return c; }
 };
 
+// intrusive doubly-linked list of child nodes (links are stored in SvgNode), so there is no separate allocation per
+//  child, traversal only touches the nodes themselves, and insert and remove are O(1); list owns the nodes
+class SvgNodeList
+{
+public:
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef SvgNode* value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef SvgNode* const* pointer;
+        typedef SvgNode* reference;
+
+        const_iterator(SvgNode* n, const SvgNodeList* l) : node(n), list(l) {}
+        SvgNode* operator*() const { return node; }
+        const_iterator& operator++() { node = node->m_nextSibling; return *this; }
+        const_iterator& operator--() { node = node ? node->m_prevSibling : list->m_last; return *this; }
+        const_iterator operator++(int) { const_iterator it(*this); ++*this; return it; }
+        const_iterator operator--(int) { const_iterator it(*this); --*this; return it; }
+        bool operator==(const const_iterator& other) const { return node == other.node; }
+        bool operator!=(const const_iterator& other) const { return node != other.node; }
+    private:
+        SvgNode* node;
+        const SvgNodeList* list;
+    };
+    // use insert()/erase() to modify list, so there is no separate mutable iterator
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    SvgNodeList() {}
+    SvgNodeList(const SvgNodeList& other) = delete;
+    SvgNodeList(SvgNode* newparent, const SvgNodeList& other)
+    {
+        for(SvgNode* node = other.m_first; node; node = node->m_nextSibling) {
+            push_back(node->clone());
+            m_last->setParent(newparent);
+        }
+    }
+    ~SvgNodeList()
+    {
+        for(SvgNode* node = m_first; node;) {
+            SvgNode* next = node->m_nextSibling;
+            delete node;
+            node = next;
+        }
+    }
+
+    iterator begin() const { return iterator(m_first, this); }
+    iterator end() const { return iterator(NULL, this); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() const { return reverse_iterator(end()); }
+    reverse_iterator rend() const { return reverse_iterator(begin()); }
+    const_reverse_iterator crbegin() const { return rbegin(); }
+    const_reverse_iterator crend() const { return rend(); }
+
+    bool empty() const { return !m_first; }
+    size_t size() const { return m_size; }
+    SvgNode* front() const { return m_first; }
+    SvgNode* back() const { return m_last; }
+
+    void push_back(SvgNode* node) { insert(NULL, node); }
+    // insert node before next, or at end if next is NULL; next must be in this list
+    void insert(SvgNode* next, SvgNode* node)
+    {
+        SvgNode* prev = next ? next->m_prevSibling : m_last;
+        node->m_prevSibling = prev;
+        node->m_nextSibling = next;
+        (prev ? prev->m_nextSibling : m_first) = node;
+        (next ? next->m_prevSibling : m_last) = node;
+        ++m_size;
+    }
+    // unlink node (w/o deleting it) and return the node that followed it
+    SvgNode* erase(SvgNode* node)
+    {
+        SvgNode* next = node->m_nextSibling;
+        (node->m_prevSibling ? node->m_prevSibling->m_nextSibling : m_first) = next;
+        (next ? next->m_prevSibling : m_last) = node->m_prevSibling;
+        node->m_prevSibling = node->m_nextSibling = NULL;
+        --m_size;
+        return next;
+    }
+
+private:
+    SvgNode* m_first = NULL;
+    SvgNode* m_last = NULL;
+    size_t m_size = 0;
+};
+
+// copy-on-write holder for payloads shared between clones (path data, pixels) - copying only copies a pointer;
+//  use mut() to modify, which first makes a private copy if payload is shared
+template<typename T>
+class cow_ptr
+{
+public:
+    cow_ptr() : p(std::make_shared<T>()) {}
+    explicit cow_ptr(const T& val) : p(std::make_shared<T>(val)) {}
+    explicit cow_ptr(T&& val) : p(std::make_shared<T>(std::move(val))) {}
+    const T& operator*() const { return *p; }
+    const T* operator->() const { return p.get(); }
+    bool shared() const { return p.use_count() > 1; }
+    T& mut() { if(shared()) p = std::make_shared<T>(*p); return *p; }
+    // replace (instead of copying) shared payload that is about to be overwritten
+    T& reset(T&& val = T()) { p = std::make_shared<T>(std::move(val)); return *p; }
+
+private:
+    std::shared_ptr<T> p;
+};
+
+// bounding volume hierarchy over bounds() of a container's children, so hit testing and culling against a rect
+//  visit O(log n) children instead of all of them; built lazily for large containers and kept in sync via
+//  invalidateBounds(): bounds changes are refit in place, structural changes (add, remove, inclChildren) rebuild
+class SvgBoundsIndex
+{
+public:
+    static constexpr size_t MIN_CHILDREN = 64;
+
+    SvgBoundsIndex(const SvgContainerNode* container) : m_container(container) {}
+    // children whose bounds overlap r, plus any children not in the index (invisible, AbsoluteMode, or w/o valid
+    //  bounds), in document order - so caller must still apply its usual per-child checks
+    void query(const SVGRect& r, std::vector<SvgNode*>* hits) const;
+    void invalidate(const SvgNode* child);
+    void invalidateAll() { m_valid = false; }
+
+private:
+    struct BVHNode { SVGRect box; int parent; int left; int right; int start; int count; };  // leaf iff count > 0
+    static constexpr int LEAF_SIZE = 4;
+
+    void update() const;
+    void rebuild() const;
+    int build(int parent, int start, int end) const;
+    void refit(int item) const;
+    bool isIndexed(const SvgNode* node) const;
+
+    const SvgContainerNode* m_container;
+    mutable std::vector<SvgNode*> m_nodes;  // children in document order
+    mutable std::vector<SVGRect> m_boxes;
+    mutable std::vector<int> m_items;  // indices into m_nodes, grouped by leaf
+    mutable std::vector<int> m_leafOf;
+    mutable std::vector<int> m_unindexed;
+    mutable std::vector<BVHNode> m_tree;
+    mutable std::unordered_map<const SvgNode*, int> m_itemOf;
+    mutable std::vector<int> m_stale;
+    mutable std::vector<char> m_isStale;
+    mutable size_t m_refits = 0;
+    mutable bool m_valid = false;
+};
+
 // consider shorter name ... SvgGroupNode?
 class SvgContainerNode : public SvgNode
 {
 public:
     SvgContainerNode() {}
     SvgContainerNode(const SvgContainerNode& other) : SvgNode(other), m_children(this, other.m_children) {}
+    ~SvgContainerNode() override;
     SvgContainerNode* clone() const override = 0;  // this is needed to clone container nodes w/o casting result
     SvgContainerNode* asContainerNode() override { return this; }
     const SvgContainerNode* asContainerNode() const override { return this; }
@@ -277,16 +490,25 @@ public:
 
     void addChild(SvgNode* child, SvgNode* next = NULL);
     SvgNode* removeChild(SvgNode* child);
-    std::list<SvgNode*>& children() { return m_children.get(); }
-    const std::list<SvgNode*>& children() const { return m_children.get(); }
-    SvgNode* firstChild() const { return children().empty() ? NULL : children().front(); }
+    SvgNodeList& children() { return m_children; }
+    const SvgNodeList& children() const { return m_children; }
+    SvgNode* firstChild() const { return m_children.front(); }
     SvgNode* nodeAt(const SVGPoint& p, bool visual_only = true) const;
+    std::vector<SvgNode*> nodesIn(const SVGRect& r, bool visual_only = true) const;
+    // NULL if container is too small to benefit from an index
+    const SvgBoundsIndex* boundsIndex() const;
     std::vector<SvgNode*> select(const char* selector, size_t nhits = SIZE_MAX) const;
     SvgNode* selectFirst(const char* selector) const;
 
     //protected:
-    cloning_container< std::list<SvgNode*> > m_children;
+    SvgNodeList m_children;
     mutable SVGRect m_removedBounds;
+    mutable std::unique_ptr<SvgBoundsIndex> m_boundsIndex;
+    // painter state after applying style of this node and ancestors (see SvgPainter::applyParentStyle())
+    mutable std::shared_ptr<SvgPaintState> m_paintState;
+    // CSS variables visible to children (see SvgCssStylesheet::varScope())
+    mutable std::shared_ptr<const SvgVarScope> m_varScope;
+    unsigned int m_varVersion = 0;  // incremented when a CSS variable is set on or removed from this node
 };
 
 class SvgG : public SvgContainerNode
@@ -378,7 +600,7 @@ public:
     void setWidth(const SvgLength& w);
     void setHeight(const SvgLength& h);
 
-    void setPreserveAspectRatio(bool v) { m_preserveAspectRatio = v; }
+    void setPreserveAspectRatio(bool v) { if(v != m_preserveAspectRatio) invalidatePaintState(); m_preserveAspectRatio = v; }
     bool preserveAspectRatio() const { return m_preserveAspectRatio; }
 #ifndef NO_DYNAMIC_STYLE
     ~SvgDocument() override;
@@ -387,10 +609,10 @@ public:
 #endif
 
     SVGRect viewBox() const { return m_viewBox; }
-    void setViewBox(const SVGRect& r) { if(r != m_viewBox) invalidate(true); m_viewBox = r; }
+    void setViewBox(const SVGRect& r) { if(r != m_viewBox) { invalidate(true); invalidatePaintState(); } m_viewBox = r; }
     // canvas rect is only used for top-level doc w/ percentage for width and/or height
     SVGRect canvasRect() const { return m_canvasRect; }
-    void setCanvasRect(const SVGRect& r) { if(r != m_canvasRect) invalidate(true); m_canvasRect = r; }
+    void setCanvasRect(const SVGRect& r) { if(r != m_canvasRect) { invalidate(true); invalidatePaintState(); } m_canvasRect = r; }
     void setUseSize(real w, real h);
 
     SVGRect viewportRect() const;
@@ -403,7 +625,15 @@ public:
     SvgNode* namedNode(const char* id) const;
     void restyleNode(SvgNode* node);
     bool canRestyle();
+    int restyleScope(char kind, const char* oldnames, const char* newnames);
+    size_t restyleCount() const { return m_restyleCount; }
     void replaceIds(SvgDocument* dest = NULL);
+    // nodes in document (incl. document itself and nested documents) w/ class or of type, for select(); index
+    //  is built on first call and then kept up to date by addChild(), removeChild(), and setXmlClass()
+    const std::unordered_set<SvgNode*>* nodesWithClass(const std::string& cls);
+    const std::unordered_set<SvgNode*>* nodesOfType(int type);
+    void updateNodeIndex(SvgNode* node, const char* oldclass, const char* newclass);
+    void indexSubtree(SvgNode* node, bool add);
 
     //private:
     real m_x = 0, m_y = 0;
@@ -419,25 +649,52 @@ public:
     // if we use unique_ptr, have to create boilerplate copy constructor
     SvgCssStylesheet* m_stylesheet = NULL;
 #endif
+    size_t m_restyleCount = 0;  // number of nodes restyled, for testing
+    std::unordered_map<std::string, std::unordered_set<SvgNode*>> m_classIndex;
+    std::unordered_map<int, std::unordered_set<SvgNode*>> m_typeIndex;
+    size_t m_indexedNodes = 0;
+    bool m_hasNodeIndex = false;
+    // only used on root document, so they cover nested documents; see SvgNode::invalidatePaintState() and
+    //  invalidateVarScopes()
+    unsigned int m_paintStateEpoch = 0;
+    unsigned int m_varScopeEpoch = 0;
+    bool m_building = false;  // set by SvgParser while creating document - nothing can be cached yet
 };
 
 class SvgImage : public SvgNode
 {
 public:
     SvgImage(Image image, const SVGRect& bounds, const char* linkStr = NULL);
+    // inline image from data: URI - decoding is deferred until pixels are needed
+    SvgImage(std::string dataUri, const SVGRect& bounds);
     SvgImage(const SvgImage& other);
     Type type() const override { return IMAGE; }
     SvgImage* clone() const override { return new SvgImage(*this); }
-    Image* image() { return &m_image; }
+    // caller may modify image, so we can no longer use original data: URI
+    Image* image() { decode(); m_dataUri.clear(); return &m_image.mut(); }
+    const Image& constImage() const { decode(); return *m_image; }
+    int imageWidth() const;
+    int imageHeight() const;
     void setSize(const SVGRect& r) { m_bounds = r; invalidate(false); }
     SVGRect viewport() const;
 
     //private:
-    Image m_image;
+    // pixels are shared with clones until modified
+    mutable cow_ptr<Image> m_image;
     SVGRect m_bounds;
     std::string m_linkStr;
+    // base64 data: URI from source document; if not empty, m_image is only valid after decode()
+    std::string m_dataUri;
 
     SVGRect srcRect;
+
+private:
+    void decode() const;
+    void decodeSize() const;
+    std::vector<unsigned char> decodeDataUri() const;
+    mutable bool m_decoded = true;
+    mutable int m_imgWidth = -1;
+    mutable int m_imgHeight = -1;
 };
 
 class SvgPath : public SvgNode
@@ -448,11 +705,13 @@ public:
     Type type() const override { return PATH; }
     SvgPath* clone() const override { return new SvgPath(*this); }
 
-    Path2D* path() { return &m_path; }
+    // path data is shared with clones until modified
+    Path2D* path() { return &m_path.mut(); }
+    const Path2D& constPath() const { return *m_path; }
     Type pathType() const { return m_pathType; }
 
     //protected:
-    Path2D m_path;
+    cow_ptr<Path2D> m_path;
     Type m_pathType;
 };
 
@@ -182,7 +182,7 @@ void SvgPainter::draw(const SvgNode* node)
 
 void SvgPainter::drawChildren(const SvgContainerNode* node)
 {
-    for(const SvgNode* child : node->children()) {
+    auto drawChild = [this](const SvgNode* child) {
         // moved here from draw() so that _draw(SvgUse*) works for, e.g,., <symbol>
         if(!child->isVisible()) {
             // should m_renderedBounds be updated in clearDirty() instead?
@@ -195,6 +195,18 @@ void SvgPainter::drawChildren(const SvgContainerNode* node)
         }
         else if(child->displayMode() != SvgNode::AbsoluteMode)
             draw(child);
+    };
+    // index holds document bounds, so can't be used for <use> content; query returns all invisible children
+    const SvgBoundsIndex* index = insideUse ? NULL : node->boundsIndex();
+    if(index) {
+        std::vector<SvgNode*> hits;
+        index->query(dirtyRect, &hits);
+        for(const SvgNode* child : hits)
+            drawChild(child);
+    }
+    else {
+        for(const SvgNode* child : node->children())
+            drawChild(child);
     }
 }
 
@@ -245,8 +257,118 @@ SVGRect SvgPainter::childrenBounds(const SvgContainerNode* node)
     return b;
 }
 
+// painter state not set by initPainter() before applyParentStyle() can differ between callers
+static bool sameBaseState(const Painter::PainterState& a, const Painter::PainterState& b)
+{
+    return a.fillBrush.color() == b.fillBrush.color() && a.fillBrush.gradient() == b.fillBrush.gradient()
+        && a.strokeBrush.color() == b.strokeBrush.color() && a.strokeBrush.gradient() == b.strokeBrush.gradient()
+        && a.strokeWidth == b.strokeWidth && a.strokeDashOffset == b.strokeDashOffset
+        && a.strokeMiterLimit == b.strokeMiterLimit && a.strokeCap == b.strokeCap && a.strokeJoin == b.strokeJoin
+        && a.strokeEffect == b.strokeEffect && a.fontId == b.fontId && a.boldFontId == b.boldFontId
+        && a.italicFontId == b.italicFontId && a.boldItalicFontId == b.boldItalicFontId
+        && a.fontPixelSize == b.fontPixelSize && a.fontWeight == b.fontWeight && a.letterSpacing == b.letterSpacing
+        && a.fontStyle == b.fontStyle && a.fontCaps == b.fontCaps && a.globalAlpha == b.globalAlpha
+        && a.colorXorMask == b.colorXorMask && a.compOp == b.compOp && a.antiAlias == b.antiAlias
+        && a.sRGBAdjAlpha == b.sRGBAdjAlpha;
+}
+
+// gradient set as fill or stroke by node's own attributes (last one wins, as in applyStyle())
+static const SvgGradient* gradientServer(const SvgNode* node, SvgAttr::StdAttr stdattr)
+{
+    const SvgGradient* grad = NULL;
+    for(const SvgAttr& attr : node->attrs) {
+        if(attr.stdAttr() == stdattr && attr.valueIs(SvgAttr::StringVal)) {
+            const SvgNode* server = node->getRefTarget(attr.stringVal());
+            if(server && server->type() == SvgNode::GRADIENT)
+                grad = static_cast<const SvgGradient*>(server);
+        }
+    }
+    return grad;
+}
+
+// returns cached state for node (a parent of node being drawn), creating it from parent's state if needed;
+//  returns NULL if state can't be cached because node or an ancestor has custom styling or is a <pattern>
+//  (applyStyle() resets transform for <pattern>)
+const SvgPaintState* SvgPainter::paintState(const SvgNode* node, const Painter::PainterState& base,
+        unsigned int epoch)
+{
+    const SvgContainerNode* container = node->asContainerNode();
+    if(!container || node->hasExt() || node->type() == SvgNode::PATTERN)
+        return NULL;
+    SvgPaintState* state = container->m_paintState.get();
+    if(state && state->epoch == epoch && sameBaseState(state->base, base))
+        return state;
+    const SvgPaintState* parentState = node->parent() ? paintState(node->parent(), base, epoch) : NULL;
+    if(node->parent() && !parentState)
+        return NULL;
+
+    // apply style w/ identity initial transform so that result is independent of initial transform
+    Transform2D tfin = initialTransform;
+    initialTransform = Transform2D();
+    p->save();
+    p->setTransform(Transform2D());
+    extraStates.emplace_back();
+    if(parentState)
+        restoreState(parentState);
+    applyStyle(node);
+
+    if(!state) {
+        container->m_paintState = std::make_shared<SvgPaintState>();
+        state = container->m_paintState.get();
+    }
+    state->base = base;
+    state->painterState = p->currState();
+    state->extraState = extraState();
+    state->transform = p->getTransform();
+    static const SvgPaintState dflt = SvgPaintState();
+    const SvgPaintState* inherited = parentState ? parentState : &dflt;
+    const SvgGradient* grad = p->currState().fillBrush.gradient() ? gradientServer(node, SvgAttr::FILL) : NULL;
+    state->fillGradient = grad ? grad : inherited->fillGradient;
+    state->fillNode = grad ? node : inherited->fillNode;
+    state->fillTransform = grad ? state->transform : inherited->fillTransform;
+    grad = p->currState().strokeBrush.gradient() ? gradientServer(node, SvgAttr::STROKE) : NULL;
+    state->strokeGradient = grad ? grad : inherited->strokeGradient;
+    state->strokeNode = grad ? node : inherited->strokeNode;
+    state->strokeTransform = grad ? state->transform : inherited->strokeTransform;
+    state->epoch = epoch;
+
+    extraStates.pop_back();
+    p->restore();
+    initialTransform = tfin;
+    return state;
+}
+
+void SvgPainter::restoreState(const SvgPaintState* state)
+{
+    Transform2D tf0 = p->getTransform();
+    p->setState(state->painterState);
+    extraState() = state->extraState;
+    if(state->fillGradient && state->painterState.fillBrush.gradient()) {
+        p->transform(state->fillTransform);
+        p->setFillBrush(gradientBrush(state->fillGradient, state->fillNode));
+        p->setTransform(tf0);
+    }
+    if(state->strokeGradient && state->painterState.strokeBrush.gradient()) {
+        p->transform(state->strokeTransform);
+        p->setStrokeBrush(gradientBrush(state->strokeGradient, state->strokeNode));
+        p->setTransform(tf0);
+    }
+    p->transform(state->transform);
+}
+
+// applying style of every ancestor is expensive for deep trees, so resulting state is cached on parent
 void SvgPainter::applyParentStyle(const SvgNode* node)
 {
+    // state can only be cached for nodes in a document - epoch of root document is bumped by any change
+    const SvgDocument* root = node->parent() ? node->rootDocument() : NULL;
+    if(root && !root->m_building) {
+        Painter::PainterState base = p->currState();
+        const SvgPaintState* state = paintState(node->parent(), base, root->m_paintStateEpoch);
+        if(state) {
+            restoreState(state);
+            return;
+        }
+    }
     std::vector<SvgNode*> parentApplyStack;
     SvgNode* parent = node->parent();
     // <use> content bounds() are relative to the <use> node, as they can be included in
@@ -467,16 +589,15 @@ void SvgPainter::_draw(const SvgDocument* doc)
 
 void SvgPainter::_draw(const SvgImage* node)
 {
-    p->drawImage(node->viewport(), node->m_image, node->srcRect);
+    p->drawImage(node->viewport(), node->constImage(), node->srcRect);
 }
 
 void SvgPainter::_draw(const SvgPath* node)
 {
-    const Path2D& m_path = node->m_path;
+    const Path2D& m_path = node->constPath();
     if(m_path.empty())
         return;
     ExtraState& state = extraState();
-    const_cast<Path2D&>(m_path).setFillRule(state.fillRule);
     real oldOpacity = p->opacity();
     // we cannot use array stored in SvgAttr directly since it may not be aligned on 4-byte boundary (crashes on
     //  some platforms) - this will obviously be inefficient if dasharray is set on a <g> with many paths, but
@@ -499,7 +620,7 @@ void SvgPainter::_draw(const SvgPath* node)
         else {
             Brush oldPen = p->strokeBrush();
             p->setStrokeBrush(Color::NONE);
-            p->drawPath(m_path);
+            p->drawPath(m_path, state.fillRule == Path2D::EvenOddFill);
             p->setStrokeBrush(oldPen);
         }
         p->setOpacity(oldOpacity * state.strokeOpacity);
@@ -508,13 +629,13 @@ void SvgPainter::_draw(const SvgPath* node)
         else {
             Brush oldBrush = p->fillBrush();
             p->setFillBrush(Color::NONE);
-            p->drawPath(m_path);
+            p->drawPath(m_path, state.fillRule == Path2D::EvenOddFill);
             p->setFillBrush(oldBrush);
         }
     }
     else if(hasPen || hasBrush) {
         p->setOpacity(oldOpacity * (hasPen ? state.strokeOpacity : state.fillOpacity));
-        p->drawPath(m_path);
+        p->drawPath(m_path, state.fillRule == Path2D::EvenOddFill);
     }
     p->setOpacity(oldOpacity);  // I don't think we need this since p->restore() is called right after we return
 
@@ -610,11 +731,11 @@ SVGRect SvgPainter::_bounds(const SvgPath* node)
     // no path is set for rect with zero width or height (to suppress drawing) but we still want bounds
     if(node->pathType() == SvgNode::RECT)
         return p->getTransform().mapRect(SVGRect(static_cast<const SvgRect*>(node)->m_rect).pad(strokewidth/2));
-    if(node->m_path.empty())
+    if(node->constPath().empty())
         return SVGRect();
     // I think we can just map the bounding rect if there is no rotation ... probably should add some tests!
-    SVGRect b = !tf.isRotating() ? tf.mapRect(node->m_path.boundingRect())
-    : Path2D(node->m_path).transform(tf).boundingRect();
+    SVGRect b = !tf.isRotating() ? tf.mapRect(node->constPath().boundingRect())
+    : node->constPath().getBBox(tf);
     //return b.pad(tf.xscale() * strokewidth/2, tf.yscale() * strokewidth/2);
     return b.pad(strokewidth/2);
 }
@@ -710,7 +831,7 @@ SVGPoint SvgPainter::drawTextText(const SvgTspan* node, SVGPoint pos, real* line
         }
         p->setStrokeWidth(oldStrokeWidth);  // restore stroke width
         if(lineh)
-            *lineh = std::max(*lineh, 1.1 * p->fontSize());
+            *lineh = std::max(*lineh, real(1.1 * p->fontSize()));
     }
     else {
         p->setTextAlign(anchor);
@@ -789,9 +910,9 @@ SVGPoint SvgPainter::drawTextTspans(const SvgTspan* node, SVGPoint pos, real* li
         SvgNode* target = tpnode->document()->namedNode(tpnode->href());
         if(!target || target->type() != SvgNode::PATH)
             return pos;
-        Path2D* path = static_cast<SvgPath*>(target)->path();
+        const Path2D& path = static_cast<SvgPath*>(target)->constPath();
         // note that we have to transform before flattening
-        textPath = target->hasTransform() ? Path2D(*path).transform(target->getTransform()).toFlat() : path->toFlat();
+        textPath = target->hasTransform() ? Path2D(path).transform(target->getTransform()).toFlat() : path.toFlat();
         //textPath.transform(p->getTransform() * target->getTransform());
         textPathOffset = tpnode->startOffset();
     }
@@ -44,6 +44,8 @@ public:
 private:
     void initPainter();
     void applyParentStyle(const SvgNode* node);
+    const SvgPaintState* paintState(const SvgNode* node, const Painter::PainterState& base, unsigned int epoch);
+    void restoreState(const SvgPaintState* state);
     void applyStyle(const SvgNode* node);
     Brush gradientBrush(const SvgGradient* gradnode, const SvgNode* dest);
     void resolveFont(SvgDocument* doc);  //, const char* families);
@@ -73,3 +75,21 @@ private:
     SVGRect _bounds(const SvgCustomNode* node);
     SVGRect childrenBounds(const SvgContainerNode* node);
 };
+
+// painter state after applying style of a container node and all its ancestors to base state; transforms
+//  are relative to transform when drawing started
+struct SvgPaintState
+{
+    Painter::PainterState base;
+    Painter::PainterState painterState;
+    SvgPainter::ExtraState extraState;
+    Transform2D transform;
+    // gradient brushes depend on transform and bounds of node where set, so must be recreated
+    const SvgGradient* fillGradient = NULL;
+    const SvgNode* fillNode = NULL;
+    Transform2D fillTransform;
+    const SvgGradient* strokeGradient = NULL;
+    const SvgNode* strokeNode = NULL;
+    Transform2D strokeTransform;
+    unsigned int epoch = 0;
+};
@@ -1,5 +1,6 @@
 #include <fstream>
 #include "svgparser.hxx"
+#include "../ulib/threadutil.hxx"
 
 
 struct SvgNamedColor {
@@ -347,138 +348,229 @@ static void pathArc(Path2D& path, real rx, real ry,
     path.addArc(xc*rx, yc*ry, rx, ry, th0, th_arc, x_axis_rotation);
 }
 
-// we take vector to use so we don't need to alloc and free for every path
-static bool parsePathData(const StringRef& dataStr, Path2D& path, std::vector<real>& points)
+// Path data is parsed in a single pass, writing coordinates directly to Path2D points (and commands, once
+//  the path turns out not to be simple) instead of going through a vector of numbers and moveTo, etc.
+// An exact pre-count of points (w/o converting numbers) was tried, but even a branchless scan costs more
+//  than it saves, as does SIMD char classification - time is dominated by number conversion.  Instead, we
+//  extrapolate from the first part of the string and reserve once.
+
+enum { PD_OTHER = 0, PD_SEP, PD_NUM, PD_CMD };
+
+static const unsigned char* pathDataCharClasses()
+{
+    static unsigned char classes[256] = {0};
+    static bool init = [](){
+        for(const char* s = " \t\r\n,"; *s; ++s) classes[(unsigned char)*s] = PD_SEP;
+        for(const char* s = "0123456789+-."; *s; ++s) classes[(unsigned char)*s] = PD_NUM;
+        for(const char* s = "MmZzLlHhVvCcSsQqTtAa"; *s; ++s) classes[(unsigned char)*s] = PD_CMD;
+        return true;
+    }();
+    (void)init;
+    return classes;
+}
+
+// read next number, skipping whitespace and a single comma
+static inline bool pathDataNumber(const char*& p, const char* end, const unsigned char* classes, real* out)
+{
+    bool comma = false;
+    for(; p != end && classes[(unsigned char)*p] == PD_SEP; ++p) {
+        if(*p == ',') {
+            if(comma) return false;
+            comma = true;
+        }
+    }
+    if(p == end || classes[(unsigned char)*p] != PD_NUM)
+        return false;
+    char* endptr;
+    *out = strToReal(p, &endptr);
+    p = endptr;
+    return true;
+}
+
+// arc flags are a single '0' or '1' and can be written w/o separator, e.g. "a1 1 0 011 1"
+static inline bool pathDataFlag(const char*& p, const char* end, const unsigned char* classes, real* out)
+{
+    bool comma = false;
+    for(; p != end && classes[(unsigned char)*p] == PD_SEP; ++p) {
+        if(*p == ',') {
+            if(comma) return false;
+            comma = true;
+        }
+    }
+    if(p == end || (*p != '0' && *p != '1'))
+        return false;
+    *out = *p++ - '0';
+    return true;
+}
+
+static bool parsePathData(const StringRef& dataStr, Path2D& path)
 {
+    // bytes to parse before extrapolating number of points
+    static constexpr size_t PATHD_RESERVE_SAMPLE = 2048;
+    const unsigned char* classes = pathDataCharClasses();
+    const char* const begin = dataStr.data();
+    const char* const end = dataStr.end();
+    const char* p = begin;
+    const char* reserveAt = begin + std::min(dataStr.size(), std::max(PATHD_RESERVE_SAMPLE, dataStr.size()/16));
+    size_t pts0 = path.size();
+
+    std::vector<SVGPoint>& pts = path.editPoints();
+    std::vector<Path2D::PathCommand>& pcmds = path.editCommands();
+    bool cmds = !path.isSimple();
+    auto addPoint = [&](real px, real py, Path2D::PathCommand cmd) {
+        pts.emplace_back(px, py);
+        if(cmds) pcmds.push_back(cmd);
+    };
+    // once a command other than initial moveTo + lineTo is seen, path needs explicit commands
+    auto needCmds = [&]() {
+        if(cmds) return;
+        cmds = true;
+        pcmds.reserve(pts.capacity());
+        if(!pts.empty()) {
+            pcmds.push_back(Path2D::MoveTo);
+            pcmds.resize(pts.size(), Path2D::LineTo);
+        }
+    };
+
     real x0 = 0, y0 = 0;  // initial point
     real x = 0, y = 0;  // current point
     char lastMode = 0;
     SVGPoint ctrlPt;
-    StringRef str = dataStr;
+    real num[7];
 
-    while(!str.isEmpty()) {
-        str.trimL();
-        char pathElem = *str;
-        ++str;
-        parseNumbersList(str, points);
-        if(pathElem == 'z' || pathElem == 'Z')
-            points.push_back(0);
-        const real* num = points.data();
-        int count = points.size();
-        // if path's points vector would growth more than once w/ 2x growth factor, reserve space now
-        if(str.isEmpty() || count/2 > path.size() + 1)  // +1 to prevent reserve on initial moveTo
-            path.reserve(path.size() + count/2);  // number of points >= number of scalars/2
-        const real* end = num + count;
-        while(num != end) {
-            bool rel = pathElem >= 'a';
+    while(p != end) {
+        while(p != end && classes[(unsigned char)*p] == PD_SEP) ++p;
+        if(p == end)
+            break;
+        if(p >= reserveAt) {
+            // at least as much reserved as our estimate of total number of points, +6% for safety
+            size_t est = pts0 + ((pts.size() - pts0)*(end - begin))/(p - begin);
+            path.reserve(est + est/16 + 8, cmds);
+            reserveAt = end;
+        }
+        char pathElem = *p++;
+        if(classes[(unsigned char)pathElem] != PD_CMD)
+            return false;
+        bool rel = pathElem >= 'a';
+        if(pathElem == 'z' || pathElem == 'Z') {
+            x = x0;
+            y = y0;
+            if(!pts.empty())
+                addPoint(x0, y0, Path2D::LineTo);
+            lastMode = pathElem;
+            continue;
+        }
+        // command is repeated while numbers follow
+        for(;;) {
             real offsetX = rel ? x : 0;
             real offsetY = rel ? y : 0;
-            switch(tolower(pathElem)) {
+            switch(pathElem | 0x20) {  // to lower case
                 case 'm':
-                    if(end - num < 2) { num = end; break; }
+                    if(!pathDataNumber(p, end, classes, &num[0]) || !pathDataNumber(p, end, classes, &num[1]))
+                        goto nextCmd;
                     x = x0 = num[0] + offsetX;
                     y = y0 = num[1] + offsetY;
-                    num += 2;
-                    path.moveTo(x0, y0);
+                    if(!pts.empty())
+                        needCmds();
+                    addPoint(x0, y0, Path2D::MoveTo);
                     // additional coord pairs following moveto command are treated as lineto commands
                     pathElem = rel ? 'l' : 'L';
                     break;
-                case 'z':
-                    x = x0;
-                    y = y0;
-                    num++;  // skip placeholder
-                    path.closeSubpath();
-                    break;
                 case 'l':
-                    if(end - num < 2) { num = end; break; }
+                    if(!pathDataNumber(p, end, classes, &num[0]) || !pathDataNumber(p, end, classes, &num[1]))
+                        goto nextCmd;
                     x = num[0] + offsetX;
                     y = num[1] + offsetY;
-                    num += 2;
-                    path.lineTo(x, y);
+                    addPoint(x, y, Path2D::LineTo);
                     break;
                 case 'h':
+                    if(!pathDataNumber(p, end, classes, &num[0]))
+                        goto nextCmd;
                     x = num[0] + offsetX;
-                    num++;
-                    path.lineTo(x, y);
+                    addPoint(x, y, Path2D::LineTo);
                     break;
                 case 'v':
+                    if(!pathDataNumber(p, end, classes, &num[0]))
+                        goto nextCmd;
                     y = num[0] + offsetY;
-                    num++;
-                    path.lineTo(x, y);
+                    addPoint(x, y, Path2D::LineTo);
                     break;
-                case 'c': {
-                    if(end - num < 6) { num = end; break; }
-                    SVGPoint c1(num[0] + offsetX, num[1] + offsetY);
-                    SVGPoint c2(num[2] + offsetX, num[3] + offsetY);
-                    SVGPoint e(num[4] + offsetX, num[5] + offsetY);
-                    num += 6;
-                    path.cubicTo(c1, c2, e);
-                    ctrlPt = c2;
-                    x = e.x;
-                    y = e.y;
+                case 'c':
+                    for(int ii = 0; ii < 6; ++ii) {
+                        if(!pathDataNumber(p, end, classes, &num[ii]))
+                            goto nextCmd;
+                    }
+                    needCmds();
+                    addPoint(num[0] + offsetX, num[1] + offsetY, Path2D::CubicTo);
+                    ctrlPt = SVGPoint(num[2] + offsetX, num[3] + offsetY);
+                    addPoint(ctrlPt.x, ctrlPt.y, Path2D::CubicTo);
+                    x = num[4] + offsetX;
+                    y = num[5] + offsetY;
+                    addPoint(x, y, Path2D::CubicTo);
                     break;
-                }
-                case 's': {
-                    if(end - num < 4) { num = end; break; }
-                    SVGPoint c1;
+                case 's':
+                    for(int ii = 0; ii < 4; ++ii) {
+                        if(!pathDataNumber(p, end, classes, &num[ii]))
+                            goto nextCmd;
+                    }
+                    needCmds();
                     if(lastMode == 'c' || lastMode == 'C' || lastMode == 's' || lastMode == 'S')
-                        c1 = SVGPoint(2*x - ctrlPt.x, 2*y - ctrlPt.y);
+                        addPoint(2*x - ctrlPt.x, 2*y - ctrlPt.y, Path2D::CubicTo);
                     else
-                        c1 = SVGPoint(x, y);
-                    SVGPoint c2(num[0] + offsetX, num[1] + offsetY);
-                    SVGPoint e(num[2] + offsetX, num[3] + offsetY);
-                    num += 4;
-                    path.cubicTo(c1, c2, e);
-                    ctrlPt = c2;
-                    x = e.x;
-                    y = e.y;
+                        addPoint(x, y, Path2D::CubicTo);
+                    ctrlPt = SVGPoint(num[0] + offsetX, num[1] + offsetY);
+                    addPoint(ctrlPt.x, ctrlPt.y, Path2D::CubicTo);
+                    x = num[2] + offsetX;
+                    y = num[3] + offsetY;
+                    addPoint(x, y, Path2D::CubicTo);
                     break;
-                }
-                case 'q': {
-                    if(end - num < 4) { num = end; break; }
-                    SVGPoint c(num[0] + offsetX, num[1] + offsetY);
-                    SVGPoint e(num[2] + offsetX, num[3] + offsetY);
-                    num += 4;
-                    path.quadTo(c, e);
-                    ctrlPt = c;
-                    x = e.x;
-                    y = e.y;
+                case 'q':
+                    for(int ii = 0; ii < 4; ++ii) {
+                        if(!pathDataNumber(p, end, classes, &num[ii]))
+                            goto nextCmd;
+                    }
+                    needCmds();
+                    ctrlPt = SVGPoint(num[0] + offsetX, num[1] + offsetY);
+                    addPoint(ctrlPt.x, ctrlPt.y, Path2D::QuadTo);
+                    x = num[2] + offsetX;
+                    y = num[3] + offsetY;
+                    addPoint(x, y, Path2D::QuadTo);
                     break;
-                }
-                case 't': {
-                    if(end - num < 2) { num = end; break; }
-                    SVGPoint e(num[0] + offsetX, num[1] + offsetY);
-                    num += 2;
-                    SVGPoint c;
+                case 't':
+                    if(!pathDataNumber(p, end, classes, &num[0]) || !pathDataNumber(p, end, classes, &num[1]))
+                        goto nextCmd;
+                    needCmds();
                     if(lastMode == 'q' || lastMode == 'Q' || lastMode == 't' || lastMode == 'T')
-                        c = SVGPoint(2*x - ctrlPt.x, 2*y - ctrlPt.y);
+                        ctrlPt = SVGPoint(2*x - ctrlPt.x, 2*y - ctrlPt.y);
                     else
-                        c = SVGPoint(x, y);
-                    path.quadTo(c, e);
-                    ctrlPt = c;
-                    x = e.x;
-                    y = e.y;
+                        ctrlPt = SVGPoint(x, y);
+                    addPoint(ctrlPt.x, ctrlPt.y, Path2D::QuadTo);
+                    x = num[0] + offsetX;
+                    y = num[1] + offsetY;
+                    addPoint(x, y, Path2D::QuadTo);
                     break;
-                }
                 case 'a': {
-                    if(end - num < 7) { num = end; break; }
-                    real rx = (*num++);
-                    real ry = (*num++);
-                    real xAxisRotation = (*num++);
-                    real largeArcFlag  = (*num++);
-                    real sweepFlag = (*num++);
-                    real ex = (*num++) + offsetX;
-                    real ey = (*num++) + offsetY;
-                    pathArc(path, rx, ry, xAxisRotation, int(largeArcFlag), int(sweepFlag), ex, ey, x, y);
+                    if(!pathDataNumber(p, end, classes, &num[0]) || !pathDataNumber(p, end, classes, &num[1])
+                            || !pathDataNumber(p, end, classes, &num[2]) || !pathDataFlag(p, end, classes, &num[3])
+                            || !pathDataFlag(p, end, classes, &num[4]) || !pathDataNumber(p, end, classes, &num[5])
+                            || !pathDataNumber(p, end, classes, &num[6]))
+                        goto nextCmd;
+                    needCmds();
+                    real ex = num[5] + offsetX;
+                    real ey = num[6] + offsetY;
+                    pathArc(path, num[0], num[1], num[2], int(num[3]), int(num[4]), ex, ey, x, y);
                     x = ex;
                     y = ey;
                     break;
                 }
-                default:
-                    return false;
             }
             lastMode = pathElem;
         }
+nextCmd:
+        // per SVG spec, we render path up to the first error (anything but a command following last number)
+        while(p != end && classes[(unsigned char)*p] == PD_SEP) ++p;
+        if(p != end && classes[(unsigned char)*p] != PD_CMD)
+            return false;
     }
     return true;
 }
@@ -491,7 +583,7 @@ SvgGlyph* SvgParser::createGlyphNode()
     StringRef pathd = useAttribute("d");
 
     SvgGlyph* glyph = new SvgGlyph(glyphname, unicode, hadv);
-    parsePathData(pathd, glyph->m_path, this->numberList);
+    parsePathData(pathd, glyph->m_path);
     return glyph;
 }
 
@@ -527,7 +619,10 @@ SvgFontFace* SvgParser::parseFontFaceNode(SvgFont* font)
 
     if(!name.isEmpty()) {
         font->setFamilyName(name.toString().c_str());
-        m_doc->addSvgFont(font);
+        if(m_doc)
+            m_doc->addSvgFont(font);
+        else
+            m_pendingFonts.push_back(font);
     }
     font->setUnitsPerEm(unitsPerEm);
     return new SvgFontFace();
@@ -578,16 +673,13 @@ SvgNode* SvgParser::createImageNode()
 
     Image image(0,0);
     if(targetref.startsWith("data")) {
-        while(!targetref.isEmpty() && !targetref.startsWith("base64,"))
-            ++targetref;
-        if(!targetref.isEmpty()) {
-            auto dec64 = base64_decode(targetref.constData()+7, targetref.size()-7);
-            image = Image::decodeBuffer(dec64.data(), dec64.size());
-            if(image.width > 0 && image.height > 0)
-                target = NULL;
-        }
-        else
-            PLATFORM_LOG("Unrecognized inline image format!\n");
+        StringRef b64ref = targetref;
+        while(!b64ref.isEmpty() && !b64ref.startsWith("base64,"))
+            ++b64ref;
+        // decoding is deferred until image is needed, so a document can be reserialized w/o ever decoding
+        if(!b64ref.isEmpty())
+            return new SvgImage(targetref.toString(), SVGRect::ltwh(x, y, w, h));
+        PLATFORM_LOG("Unrecognized inline image format!\n");
     }
     else if(!targetref.isEmpty()) {
         std::vector<unsigned char> buff;
@@ -606,6 +698,18 @@ SvgNode* SvgParser::createLineNode()
     return new SvgPath(Path2D().addLine(SVGPoint(x1, y1), SVGPoint(x2, y2)), SvgNode::LINE);
 }
 
+static void linkGradient(SvgGradient* gradNode, SvgNode* prop)
+{
+    if(prop && prop->type() == SvgNode::GRADIENT) {
+        SvgGradient* inherited = static_cast<SvgGradient*>(prop);
+        gradNode->setStopLink(inherited);
+        // TODO: need to better support deferred resolution of link
+        // TODO: all attributes are subject to inheritance, not just stops and matrix
+        if(!gradNode->hasTransform() && !inherited->getTransform().isIdentity())
+            gradNode->setTransform(inherited->getTransform());
+    }
+}
+
 void SvgParser::parseBaseGradient(SvgGradient* gradNode)
 {
     StringRef link = useHref();
@@ -613,25 +717,23 @@ void SvgParser::parseBaseGradient(SvgGradient* gradNode)
     StringRef spread = useAttribute("spreadMethod");
     StringRef units = useAttribute("gradientUnits");
 
-    Transform2D tf;
+    if(!trans.isEmpty())
+        gradNode->setTransform(parseTransformMatrix(trans));
     if(!link.isEmpty()) {
-        SvgNode* prop = m_doc->namedNode(link.toString().c_str());
-        if(prop && prop->type() == SvgNode::GRADIENT) {
-            SvgGradient* inherited = static_cast<SvgGradient*>(prop);
-            gradNode->setStopLink(inherited);
-            // TODO: need to better support deferred resolution of link
-            // TODO: all attributes are subject to inheritance, not just stops and matrix
-            tf = inherited->getTransform();
+        if(m_doc)
+            linkGradient(gradNode, m_doc->namedNode(link.toString().c_str()));
+        else {
+            // worker thread: link to earlier element in this chunk now, otherwise to an element preceding the
+            //  chunk when it is merged
+            std::string href = link.toString();
+            auto it = m_chunkIds.find(href[0] == '#' ? href.substr(1) : href);
+            if(it != m_chunkIds.end())
+                linkGradient(gradNode, it->second);
+            else
+                m_pendingLinks.emplace_back(gradNode, href.c_str());
         }
     }
 
-    if(!trans.isEmpty()) {
-        tf = parseTransformMatrix(trans);
-        gradNode->setTransform(tf);
-    }
-    else if(!tf.isIdentity())
-        gradNode->setTransform(tf);
-
     Gradient& grad = gradNode->m_gradient;
     grad.setSpread(Gradient::Spread(parseEnum(spread, {{"pad", Gradient::PadSpread},
         {"reflect", Gradient::ReflectSpread}, {"repeat", Gradient::RepeatSpread}}, Gradient::PadSpread)));
@@ -687,7 +789,7 @@ SvgNode* SvgParser::createPathNode()
 {
     StringRef data = useAttribute("d");
     SvgPath* path = new SvgPath();
-    parsePathData(data, path->m_path, this->numberList);
+    parsePathData(data, *path->path());
     return path;
 }
 
@@ -696,10 +798,10 @@ SvgNode* SvgParser::createPolygonNode()
     StringRef spoints = useAttribute("points");
     std::vector<real>& points = parseNumbersList(spoints);
     SvgPath* path = new SvgPath(SvgNode::POLYGON);
-    path->m_path.reserve(points.size()/2 + 1);
+    path->path()->reserve(points.size()/2 + 1);
     for(size_t ii = 0; ii+1 < points.size(); ii += 2)
-        path->m_path.addPoint(points[ii], points[ii+1]);
-    path->m_path.closeSubpath();
+        path->path()->addPoint(points[ii], points[ii+1]);
+    path->path()->closeSubpath();
     return path;
 }
 
@@ -708,9 +810,9 @@ SvgNode* SvgParser::createPolylineNode()
     StringRef spoints = useAttribute("points");
     std::vector<real>& points = parseNumbersList(spoints);
     SvgPath* path = new SvgPath(SvgNode::POLYLINE);
-    path->m_path.reserve(points.size()/2);
+    path->path()->reserve(points.size()/2);
     for(size_t ii = 0; ii+1 < points.size(); ii += 2)
-        path->m_path.addPoint(points[ii], points[ii+1]);
+        path->path()->addPoint(points[ii], points[ii+1]);
     return path;
 }
 
@@ -817,54 +919,29 @@ SvgNode* SvgParser::createNode(StringRef name)
     if(name.isEmpty())
         return NULL;
 
-    StringRef ref(name + 1);
-    switch(name[0]) {
-        case 'a':
-            if(ref.isEmpty()) return createANode();
-            break;
-        case 'c':
-            if(ref == "ircle") return createCircleNode();
-            break;
-        case 'd':
-            if(ref == "efs") return createDefsNode();
-            break;
-        case 'e':
-            if(ref == "llipse") return createEllipseNode();
-            break;
-        case 'f':
-            if(ref == "ont") return createFontNode();
-            break;
-        case 'g':
-            if(ref.isEmpty()) return createGNode();
-            break;
-        case 'i':
-            if(ref == "mage") return createImageNode();
-            break;
-        case 'l':
-            if(ref == "ine") return createLineNode();
-            if(ref == "inearGradient") return createLinearGradientNode();
-            break;
-        case 'p':
-            if(ref == "ath") return createPathNode();
-            if(ref == "attern") return createPatternNode();
-            if(ref == "olygon") return createPolygonNode();
-            if(ref == "olyline") return createPolylineNode();
-            break;
-        case 'r':
-            if(ref == "ect") return createRectNode();
-            if(ref == "adialGradient") return createRadialGradientNode();
-            break;
-        case 's':
-            if(ref == "vg") return createSvgDocumentNode();
-            if(ref == "ymbol") return createSymbolNode();
-            break;
-        case 't':
-            if(ref == "ext") return createTextNode();
-            if(ref == "span") return createTspanNode();  // shouldn't be here since <tspan> can only be inside <text>
-            break;
-        case 'u':
-            if(ref == "se") return createUseNode();
-            break;
+    // hash collisions are caught at compile time as duplicate case labels
+    switch(constHash(name.data(), name.size())) {
+        case constHash("a"):              if(name == "a") return createANode(); break;
+        case constHash("circle"):         if(name == "circle") return createCircleNode(); break;
+        case constHash("defs"):           if(name == "defs") return createDefsNode(); break;
+        case constHash("ellipse"):        if(name == "ellipse") return createEllipseNode(); break;
+        case constHash("font"):           if(name == "font") return createFontNode(); break;
+        case constHash("g"):              if(name == "g") return createGNode(); break;
+        case constHash("image"):          if(name == "image") return createImageNode(); break;
+        case constHash("line"):           if(name == "line") return createLineNode(); break;
+        case constHash("linearGradient"): if(name == "linearGradient") return createLinearGradientNode(); break;
+        case constHash("path"):           if(name == "path") return createPathNode(); break;
+        case constHash("pattern"):        if(name == "pattern") return createPatternNode(); break;
+        case constHash("polygon"):        if(name == "polygon") return createPolygonNode(); break;
+        case constHash("polyline"):       if(name == "polyline") return createPolylineNode(); break;
+        case constHash("rect"):           if(name == "rect") return createRectNode(); break;
+        case constHash("radialGradient"): if(name == "radialGradient") return createRadialGradientNode(); break;
+        case constHash("svg"):            if(name == "svg") return createSvgDocumentNode(); break;
+        case constHash("symbol"):         if(name == "symbol") return createSymbolNode(); break;
+        case constHash("text"):           if(name == "text") return createTextNode(); break;
+        // shouldn't be here since <tspan> can only be inside <text>
+        case constHash("tspan"):          if(name == "tspan") return createTspanNode(); break;
+        case constHash("use"):            if(name == "use") return createUseNode(); break;
         default:
             break;
     }
@@ -874,6 +951,14 @@ SvgNode* SvgParser::createNode(StringRef name)
 bool SvgParser::parseCoreNode(SvgNode* node)
 {
     node->setXmlId(useId());
+    if(!m_doc && node->xmlId()[0]) {
+        // worker thread: same lookup as SvgNode::setXmlId(), with our temporary root standing in for m_doc
+        SvgNode* p = node->parent() ? node->parent() : node;
+        while(p->parent() && p->type() != SvgNode::DOC)
+            p = p->parent();
+        if(p == m_nodes.front())
+            m_chunkIds[node->xmlId()] = node;
+    }
     node->setXmlClass(useAttribute("class"));
     const char* tfstr = useAttribute("transform");
     if(node->type() == SvgNode::GRADIENT) tfstr = useAttribute("gradientTransform");
@@ -936,10 +1021,11 @@ bool SvgParser::startElement(StringRef nodeName, const XmlStreamAttributes& attr
             m_inStyle = true;
         return iscss;
     }
-    else if(!m_doc) {
+    else if(m_nodes.empty()) {
         if(nodeName != "svg")
             return false;
         m_doc = createSvgDocumentNode();
+        m_doc->m_building = true;  // cleared when parsing is done
         node = m_doc;
     }
     else if(parent->type() == SvgNode::TEXT || parent->type() == SvgNode::TSPAN || parent->type() == SvgNode::TEXTPATH) {
@@ -1034,11 +1120,14 @@ void SvgParser::parse(XmlStreamReader* const xml)
         switch(xml->tokenType()) {
             case XmlStreamReader::StartDocument:
                 // this handles the case of the reader already opened on the <svg> node (instead of its parent)
-                if(StringRef(xml->name()) != "svg")
+                //  or on a subtree for parallel parsing (m_nodes not empty)
+                if(m_nodes.empty() && StringRef(xml->name()) != "svg")
                     break;
             case XmlStreamReader::StartElement:
+            {
+                bool isroot = m_nodes.empty();
                 if(!startElement(xml->name(), xml->attributes())) {
-                    if(!m_doc)
+                    if(m_nodes.empty())
                         return;
                     m_states.pop_back();
                     if(m_nodes.back()->asContainerNode())
@@ -1046,7 +1135,13 @@ void SvgParser::parse(XmlStreamReader* const xml)
                     else
                         delete xml->readNodeAsFragment();  // read node to skip even if we can't add it to doc
                 }
+                else if((isroot || xml->node() == m_splitCandidate) && parseChildrenParallel(xml)) {
+                    endElement(xml->name());
+                    xml->skipNode();
+                    done = m_nodes.empty();
+                }
                 break;
+            }
                 // EndDocument means atEnd() returns true, so this never runs - maybe move below loop?
                 //case XmlStreamReader::EndDocument:
                 //    if(strcmp(xml->name(), "svg") != 0)
@@ -1078,18 +1173,151 @@ void SvgParser::parse(XmlStreamReader* const xml)
 #ifndef NO_DYNAMIC_STYLE
     if(m_doc && !m_stylesheet->rules().empty()) {
         m_stylesheet->sort_rules();
-        m_doc->setStylesheet(m_stylesheet.release());
+        SvgCssStylesheet* stylesheet = m_stylesheet.release();
+        m_doc->setStylesheet(stylesheet);
+        unsigned int nthreads = parallelThreads > 0 ? parallelThreads : std::thread::hardware_concurrency();
+        bool matched = parallelStyleMinNodes > 0 && nthreads > 1
+            && stylesheet->matchSubtree(m_doc, nthreads, parallelStyleMinNodes);
         m_doc->restyle();
+        if(matched)
+            stylesheet->clearMatched();
     }
 #endif
     m_hasErrors = xml->parseStatus() != 0;
 }
 
+static size_t xmlSubtreeSize(const pugi::xml_node& top)
+{
+    size_t n = 1;
+    pugi::xml_node node = top.first_child();
+    while(node && node != top) {
+        if(node.type() == pugi::node_element)
+            ++n;
+        if(node.first_child())
+            node = node.first_child();
+        else {
+            while(!node.next_sibling() && node != top)
+                node = node.parent();
+            if(node != top)
+                node = node.next_sibling();
+        }
+    }
+    return n;
+}
+
+size_t SvgParser::parallelMinNodes = 0;
+size_t SvgParser::parallelStyleMinNodes = 0;
+unsigned int SvgParser::parallelThreads = 0;
+
+// Node creation (attribute parsing in particular) dominates parse time for big documents once pugixml is
+//  done, so split the children of the current element into contiguous chunks and build each chunk on a
+//  separate parser w/o a document.  Subtrees are then attached in document order, so ids, fonts, gradient
+//  links, and <style> rules end up the same as for serial parsing
+bool SvgParser::parseChildrenParallel(XmlStreamReader* const xml)
+{
+    SvgNode* parent = m_nodes.back();
+    if(parallelMinNodes == 0 || (parent->type() != SvgNode::DOC && parent->type() != SvgNode::G))
+        return false;
+    unsigned int nthreads = parallelThreads > 0 ? parallelThreads : std::thread::hardware_concurrency();
+    if(nthreads < 2)
+        return false;
+
+    std::vector< std::pair<pugi::xml_node, size_t> > children;
+    size_t total = 0;
+    for(pugi::xml_node child = xml->node().first_child(); child; child = child.next_sibling()) {
+        children.emplace_back(child, child.type() == pugi::node_element ? xmlSubtreeSize(child) : 0);
+        total += children.back().second;
+    }
+    if(total < parallelMinNodes)
+        return false;
+    // if most of document is inside a single <g> (a common case), split that instead
+    for(auto& child : children) {
+        if(child.second > total/2) {
+            if(StringRef(child.first.name()) == "g")
+                m_splitCandidate = child.first;
+            return false;
+        }
+    }
+
+    // several chunks per thread to even out load
+    size_t chunksize = std::max(total/(4*nthreads), size_t(1024));
+    std::vector< std::unique_ptr<SvgParser> > workers;
+    std::vector< std::future<void> > results;
+    ThreadPool pool(nthreads);
+    size_t n = 0;
+    pugi::xml_node first = children.front().first;
+    for(size_t ii = 0; ii < children.size(); ++ii) {
+        n += children[ii].second;
+        if(n < chunksize && ii + 1 < children.size())
+            continue;
+        pugi::xml_node last = ii + 1 < children.size() ? children[ii + 1].first : pugi::xml_node();
+        workers.emplace_back(new SvgParser());
+        SvgParser* w = workers.back().get();
+        w->m_fileName = m_fileName;
+        w->m_dpi = m_dpi;
+        w->m_states.push_back(currState());
+        w->m_nodes.push_back(new SvgG());
+        results.push_back(pool.enqueue([=](){
+            w->parseSubtrees(first, last);
+        }));
+        first = last;
+        n = 0;
+    }
+
+    for(size_t ii = 0; ii < workers.size(); ++ii) {
+        results[ii].wait();
+        mergeSubtrees(workers[ii].get());
+    }
+    return true;
+}
+
+// run on worker thread: m_nodes.front() is a temporary container for the subtrees
+void SvgParser::parseSubtrees(pugi::xml_node first, pugi::xml_node last)
+{
+    SvgContainerNode* root = m_nodes.front()->asContainerNode();
+    for(pugi::xml_node child = first; child != last; child = child.next_sibling()) {
+        pugi::xml_node_type type = child.type();
+        if(type == pugi::node_element) {
+            XmlStreamReader reader(child);
+            parse(&reader);
+            // EndElement is not reported for top node of reader
+            if(m_inStyle) {
+                m_inStyle = false;
+                root->addChild(new SvgXmlFragment(new XmlFragment(child)));
+            }
+            m_nodes.resize(1);
+            m_states.resize(1);
+        }
+        else if(type == pugi::node_pi || type == pugi::node_comment)
+            root->addChild(new SvgXmlFragment(new XmlFragment(child)));
+    }
+}
+
+void SvgParser::mergeSubtrees(SvgParser* worker)
+{
+    SvgContainerNode* parent = m_nodes.back()->asContainerNode();
+    std::unique_ptr<SvgNode> root(worker->m_nodes.front());
+    // links not resolved within chunk must be resolved before its ids are registered, as for serial parsing
+    for(PendingLink& link : worker->m_pendingLinks)
+        linkGradient(link.node, m_doc->namedNode(link.href.c_str()));
+    SvgNodeList& subtrees = root->asContainerNode()->children();
+    while(!subtrees.empty()) {
+        SvgNode* node = subtrees.front();
+        subtrees.erase(node);
+        parent->addChild(node);  // registers ids
+    }
+    for(SvgFont* font : worker->m_pendingFonts)
+        m_doc->addSvgFont(font);
+    m_stylesheet->append_rules(*worker->m_stylesheet);
+}
+
 SvgDocument* SvgParser::parseXml(XmlStreamReader* reader)
 {
     m_states.emplace_back();
     parse(reader);
     m_states.clear();
+    if(m_doc)
+        m_doc->m_building = false;
     return m_doc;
 }
 
@@ -1101,6 +1329,8 @@ SvgDocument* SvgParser::parseXmlFragment(XmlStreamReader* reader)
     parse(reader);
     endElement("svg");
     m_states.clear();
+    if(m_doc)
+        m_doc->m_building = false;
     return m_doc;
 }
 
@@ -1143,3 +1373,269 @@ SvgParser::SvgParser()
     numberList.reserve(4096);
     m_stylesheet.reset(new SvgCssStylesheet);
 }
+
+#ifdef SVGPARSER_PERF
+// build w/ rest of library and -DSVGPARSER_PERF; args: <number of groups>
+#include <chrono>
+#include "../nanovg/nanovg_sw.h"
+
+int main(int argc, char* argv[])
+{
+  int ngroups = argc > 1 ? atoi(argv[1]) : 100000;
+  std::string svg = "<svg xmlns='http://www.w3.org/2000/svg'>\n";
+  char buff[1024];
+  for(int ii = 0; ii < ngroups; ++ii) {
+    snprintf(buff, sizeof(buff), "<g id='g%d' class='c%d' transform='translate(%d 2)'>"
+        "<path d='M%d %d l10 10 h2 v3z' fill='red' stroke='#123456' stroke-width='2' opacity='0.5'/>"
+        "<rect x='%d' y='1' width='3' height='4' style='stroke:red;stroke-width:2'/>"
+        "<circle cx='1' cy='2' r='%d' fill='none' stroke='blue'/></g>\n", ii, ii % 1000, ii, ii, ii+1, ii, ii%17+1);
+    svg.append(buff);
+  }
+  svg.append("</svg>\n");
+
+  double tparse = 1E9, tdestroy = 1E9;
+  for(int rep = 0; rep < 5; ++rep) {
+    auto t0 = std::chrono::steady_clock::now();
+    SvgDocument* doc = SvgParser().parseString(svg.c_str(), svg.size());
+    auto t1 = std::chrono::steady_clock::now();
+    delete doc;
+    auto t2 = std::chrono::steady_clock::now();
+    tparse = std::min(tparse, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    tdestroy = std::min(tdestroy, std::chrono::duration<double, std::milli>(t2 - t1).count());
+  }
+  PLATFORM_LOG("%d groups: parse %.1f ms, destroy %.1f ms\n", ngroups, tparse, tdestroy);
+
+  // name -> StdAttr, node type, and enum lookups
+  const char* names[] = {"fill", "stroke-width", "x", "transform", "font-weight", "letter-spacing", "d", "class"};
+  const char* enums[] = {"evenodd", "nonzero", "bold", "round", "miter", "middle", "hidden", "src-over"};
+  int nlookups = 0, sum = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for(int rep = 0; rep < 1000000; ++rep) {
+    for(size_t ii = 0; ii < sizeof(names)/sizeof(names[0]); ++ii) {
+      sum += SvgAttr::nameToStdAttr(names[ii]) + SvgNode::nameToType(names[ii]);
+      sum += parseEnum(enums[ii], SvgStyle::lineJoin, 0) + parseEnum(enums[ii], SvgStyle::compOp, 0);
+      nlookups += 4;
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  PLATFORM_LOG("%d name lookups: %.1f ns/lookup (%d)\n", nlookups,
+      std::chrono::duration<double, std::nano>(t1 - t0).count()/nlookups, sum);
+
+  // child traversal of wide (above) and deep trees
+  std::string deep = "<svg xmlns='http://www.w3.org/2000/svg'>\n";
+  for(int ii = 0; ii < 1000; ++ii)
+    deep.append("<g><rect x='1' y='2' width='3' height='4'/><circle cx='1' cy='2' r='3'/>");
+  for(int ii = 0; ii < 1000; ++ii)
+    deep.append("</g>");
+  deep.append("</svg>\n");
+  for(const std::string* src : {&svg, &deep}) {
+    std::unique_ptr<SvgDocument> doc(SvgParser().parseString(src->c_str(), src->size()));
+    size_t nhits = 0;
+    t0 = std::chrono::steady_clock::now();
+    for(int rep = 0; rep < 20; ++rep)
+      nhits += doc->select("rect").size();
+    t1 = std::chrono::steady_clock::now();
+    PLATFORM_LOG("%s tree traversal: %.2f ms (%d)\n", src == &svg ? "wide" : "deep",
+        std::chrono::duration<double, std::milli>(t1 - t0).count()/20, int(nhits));
+  }
+
+  // hit testing and region queries on a grid of shapes (served by bounds index after first query)
+  Painter::vg = nvgswCreate(NVG_AUTOW_DEFAULT | NVG_IMAGE_SRGB);
+  std::string grid = "<svg xmlns='http://www.w3.org/2000/svg'>\n";
+  for(int ii = 0; ii < ngroups; ++ii) {
+    snprintf(buff, sizeof(buff), "<rect x='%d' y='%d' width='8' height='8'/>\n", (ii % 1000)*10, (ii/1000)*10);
+    grid.append(buff);
+  }
+  grid.append("</svg>\n");
+  std::unique_ptr<SvgDocument> doc(SvgParser().parseString(grid.c_str(), grid.size()));
+  doc->bounds();
+  t0 = std::chrono::steady_clock::now();
+  int nhits = doc->nodeAt(SVGPoint(4, 4)) != NULL;
+  t1 = std::chrono::steady_clock::now();
+  double tbuild = std::chrono::duration<double, std::milli>(t1 - t0).count();
+  t0 = std::chrono::steady_clock::now();
+  for(int ii = 0; ii < 1000; ++ii) {
+    real x = (ii*7919 % 1000)*10 + 4, y = (ii % (ngroups/1000 + 1))*10 + 4;
+    nhits += doc->nodeAt(SVGPoint(x, y)) != NULL;
+    nhits += doc->nodesIn(SVGRect::ltwh(x, y, 40, 40)).size();
+  }
+  t1 = std::chrono::steady_clock::now();
+  PLATFORM_LOG("hit testing: first query %.1f ms, then %.1f us/query (%d)\n",
+      tbuild, std::chrono::duration<double, std::micro>(t1 - t0).count()/2000, nhits);
+  return 0;
+}
+#endif
+
+#ifdef SVGPARSER_TEST
+// build w/ rest of library and -DSVGPARSER_TEST; checks that parallel parsing gives same result as serial
+#include <sstream>
+#include "../nanovg/nanovg_sw.h"
+#include "svgwriter.hxx"
+#include "svgpainter.hxx"
+
+static std::string serialize(SvgDocument* doc)
+{
+  XmlStreamWriter xmlwriter;
+  SvgWriter(xmlwriter).serialize(doc);
+  std::ostringstream ss;
+  xmlwriter.save(ss);
+  return ss.str();
+}
+
+static Image render(SvgDocument* doc)
+{
+  Image img(100, 100);
+  img.fill(0xFFFFFFFF);
+  Painter painter(&img);
+  painter.beginFrame();
+  SvgPainter(&painter).drawNode(doc);
+  painter.endFrame();
+  return img;
+}
+
+static int compareParallel(const std::string& svg, const char* label)
+{
+  int nerrors = 0;
+  SvgParser::parallelMinNodes = 0;
+  std::unique_ptr<SvgDocument> serial(SvgParser().parseString(svg.c_str(), svg.size()));
+  std::string expected = serialize(serial.get());
+  Image expectedImg = render(serial.get());
+  for(unsigned int nthreads : {2, 8}) {
+    SvgParser::parallelMinNodes = 1;
+    SvgParser::parallelThreads = nthreads;
+    std::unique_ptr<SvgDocument> doc(SvgParser().parseString(svg.c_str(), svg.size()));
+    if(serialize(doc.get()) != expected) {
+      PLATFORM_LOG("%s: serialization differs w/ %u threads\n", label, nthreads);
+      ++nerrors;
+    }
+    if(!(render(doc.get()) == expectedImg)) {
+      PLATFORM_LOG("%s: rendering differs w/ %u threads\n", label, nthreads);
+      ++nerrors;
+    }
+  }
+  SvgParser::parallelMinNodes = 0;
+  SvgParser::parallelThreads = 0;
+  return nerrors;
+}
+
+// class list can be separated by any whitespace; CSS matching, class index and add/removeClass must agree
+static int testClassLists()
+{
+  const char* svg = "<svg xmlns='http://www.w3.org/2000/svg'><style>.a { fill: red } .b { stroke: blue }"
+      " .c { opacity: 0.5 }</style><rect id='r' width='10' height='10'/></svg>";
+  std::unique_ptr<SvgDocument> doc(SvgParser().parseString(svg));
+  SvgNode* node = doc->namedNode("r");
+  int nerrors = 0;
+  auto check = [&](bool ok, const char* what) {
+    if(!ok) {
+      PLATFORM_LOG("class list: %s failed\n", what);
+      ++nerrors;
+    }
+  };
+  // XML parser normalizes whitespace in attributes, so set class directly
+  node->setXmlClass("a\tb\nc");
+  check(node->hasClass("a") && node->hasClass("b") && node->hasClass("c"), "hasClass");
+  check(doc->select(".b").size() == 1 && doc->select(".c").size() == 1, "select");
+  check(node->getAttr("stroke", SvgAttr::CSSSrc) && node->getAttr("opacity", SvgAttr::CSSSrc), "CSS match");
+  node->addClass("b");
+  check(strcmp(node->xmlClass(), "a\tb\nc") == 0, "addClass of existing class");
+  node->removeClass("b");
+  check(!node->hasClass("b") && node->hasClass("a") && node->hasClass("c"), "removeClass");
+  check(doc->select(".b").empty() && doc->select(".c").size() == 1, "select after removeClass");
+  check(!node->getAttr("stroke", SvgAttr::CSSSrc) && node->getAttr("opacity", SvgAttr::CSSSrc),
+      "restyle after removeClass");
+  node->setXmlClass("c\r\n a");
+  check(node->getAttr("fill", SvgAttr::CSSSrc) && node->getAttr("opacity", SvgAttr::CSSSrc), "reordered classes");
+  return nerrors;
+}
+
+// unknown attribute names are not interned, but must still match each other (incl. CSS variables)
+static int testAttrNames()
+{
+  const char* svg = "<svg xmlns='http://www.w3.org/2000/svg'><style>.a { --my-color: blue; data-foo: 3 }"
+      " rect { fill: var(--my-color) }</style><g class='a'><rect id='r' width='10' height='10' data-foo='1'"
+      " style='data-bar: 4'/></g></svg>";
+  std::unique_ptr<SvgDocument> doc(SvgParser().parseString(svg));
+  SvgNode* node = doc->namedNode("r");
+  int nerrors = 0;
+  auto check = [&](bool ok, const char* what) {
+    if(!ok) {
+      PLATFORM_LOG("attr names: %s failed\n", what);
+      ++nerrors;
+    }
+  };
+  std::string name = "clip-path";
+  check(SvgAttr::internName(name.c_str()) == SvgAttr::internName("clip-path"), "known name interned");
+  check(!SvgAttr::internName("data-foo") && !SvgAttr::internName("--my-color"), "unknown name not interned");
+  check(SvgAttr("data-foo", 1).sameName(SvgAttr(std::string("data-foo").c_str(), 2)), "sameName");
+  check(strcmp(node->getStringAttr("data-foo", ""), "1") == 0 && strcmp(node->getStringAttr("data-bar", ""), "4") == 0,
+      "getAttr");
+  node->setAttr(SvgAttr("data-foo", 2));
+  auto nfoo = std::count_if(node->attrs.begin(), node->attrs.end(),
+      [](const SvgAttr& a){ return a.nameIs("data-foo") && a.src() == SvgAttr::XMLSrc; });
+  check(nfoo == 1 && node->getIntAttr("data-foo") == 2, "replace attr");
+  const SvgAttr* fill = node->getAttr("fill", SvgAttr::CSSSrc);
+  check(fill && fill->valueIs(SvgAttr::ColorVal) && fill->colorVal() == Color::BLUE, "CSS variable");
+  return nerrors;
+}
+
+// size of inline image should come from header alone, incl. for JPEG w/ large metadata segment before frame header
+static int testImageSize()
+{
+  Image img(300, 200);
+  img.fill(0xFF0080FF);
+  auto png = img.encodePNG();
+  auto jpg = img.encodeJPEG();
+  // insert 20KB comment segment after SOI marker
+  std::vector<unsigned char> bigjpg(jpg->begin(), jpg->begin() + 2);
+  std::vector<unsigned char> com(20000 + 4, 'x');
+  com[0] = 0xFF;  com[1] = 0xFE;  com[2] = 20002 >> 8;  com[3] = 20002 & 0xFF;
+  bigjpg.insert(bigjpg.end(), com.begin(), com.end());
+  bigjpg.insert(bigjpg.end(), jpg->begin() + 2, jpg->end());
+  struct { const char* label; std::string uri; } cases[] = {
+    {"PNG", "data:image/png;base64," + base64_encode(png->data(), png->size())},
+    {"JPEG", "data:image/jpeg;base64," + base64_encode(jpg->data(), jpg->size())},
+    {"JPEG w/ comment", "data:image/jpeg;base64," + base64_encode(bigjpg.data(), bigjpg.size())},
+    // payload cut off after header
+    {"truncated PNG", "data:image/png;base64," + base64_encode(png->data(), png->size()).substr(0, 200)}
+  };
+  int nerrors = 0;
+  for(auto& c : cases) {
+    SvgImage node(c.uri, SVGRect::ltwh(0, 0, 0, 0));
+    SVGRect vp = node.viewport();
+    if(vp.width() != 300 || vp.height() != 200 || node.m_image->width != 0) {
+      PLATFORM_LOG("image size: %s got %.0f x %.0f (decoded: %d)\n",
+          c.label, vp.width(), vp.height(), node.m_image->width != 0);
+      ++nerrors;
+    }
+  }
+  return nerrors;
+}
+
+int main(int argc, char* argv[])
+{
+  Painter::vg = nvgswCreate(NVG_AUTOW_DEFAULT | NVG_IMAGE_SRGB);
+  int nerrors = testClassLists();
+  nerrors += testImageSize();
+  nerrors += testAttrNames();
+  // gradient href to a later element is not resolved by serial parser, so it must not be for parallel either,
+  //  whether or not the later element ends up in the same chunk
+  for(int nfiller : {0, 10, 1500, 5000}) {
+    std::string svg = "<svg xmlns='http://www.w3.org/2000/svg' xmlns:xlink='http://www.w3.org/1999/xlink'"
+        " width='100' height='100'>\n<linearGradient id='early' xlink:href='#late'/>\n"
+        "<rect width='100' height='100' fill='url(#early)'/>\n";
+    char buff[256];
+    for(int ii = 0; ii < nfiller; ++ii) {
+      snprintf(buff, sizeof(buff), "<rect id='r%d' x='%d' y='1' width='1' height='1' fill='none'/>\n", ii, ii);
+      svg.append(buff);
+    }
+    svg.append("<linearGradient id='late'><stop offset='0' stop-color='red'/><stop offset='1' stop-color='blue'/>"
+        "</linearGradient>\n<linearGradient id='after' xlink:href='#late'/>\n"
+        "<rect x='10' y='10' width='20' height='20' fill='url(#after)'/>\n</svg>\n");
+    snprintf(buff, sizeof(buff), "forward href w/ %d filler elements", nfiller);
+    nerrors += compareParallel(svg, buff);
+  }
+  PLATFORM_LOG("SvgParser test completed with %d errors\n", nerrors);
+  return nerrors;
+}
+#endif
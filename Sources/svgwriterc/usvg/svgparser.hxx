@@ -31,6 +31,14 @@ public:
   // optional handler to return stream for a file name - to support, e.g., embedded resources
   static std::function<std::istream*(const char*)> openStream;
 
+  // children of <svg> (or of a <g> holding most of the document) are parsed on multiple threads if the
+  //  element has at least parallelMinNodes descendants; 0 (default) to disable
+  static size_t parallelMinNodes;
+  // CSS rules are matched on multiple threads if document has at least parallelStyleMinNodes nodes; 0 (default)
+  //  to disable
+  static size_t parallelStyleMinNodes;
+  static unsigned int parallelThreads;  // 0 to use hardware concurrency
+
 private:
   struct State {
     real emPx = 12;
@@ -55,7 +63,22 @@ private:
   bool m_inStyle = false;
   std::unique_ptr<SvgCssStylesheet> m_stylesheet;
 
+  // for parallel parsing - subtrees are built w/o a document, so anything needing m_doc is deferred
+  pugi::xml_node m_splitCandidate;
+  std::vector<SvgFont*> m_pendingFonts;
+  struct PendingLink {
+    SvgGradient* node;
+    std::string href;
+    PendingLink(SvgGradient* n, const char* h) : node(n), href(h) {}
+  };
+  std::vector<PendingLink> m_pendingLinks;
+  // ids which serial parsing would have registered in m_doc so far, so href only links to earlier elements
+  std::unordered_map<std::string, SvgNode*> m_chunkIds;
+
   void parse(XmlStreamReader* const xml);
+  bool parseChildrenParallel(XmlStreamReader* const xml);
+  void parseSubtrees(pugi::xml_node first, pugi::xml_node last);
+  void mergeSubtrees(SvgParser* worker);
   const char* useAttribute(const char* name);
   bool startElement(StringRef localName, const XmlStreamAttributes& attributes);
   bool endElement(StringRef localName);
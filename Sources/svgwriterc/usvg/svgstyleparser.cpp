@@ -1,5 +1,6 @@
 #include "svgstyleparser.hxx"
 #include "svgparser.hxx"
+#include "../ulib/threadutil.hxx"
 
 static real clamp(real val, real min, real max) { return std::max(min, std::min(val, max)); }
 
@@ -14,19 +15,18 @@ std::string idFromPaintUrl(StringRef id)
   return id.toString();
 }
 
-static SvgAttr parsePaint(const char* name, const char* valuestr)
+static SvgAttr parsePaint(const char* name, StringRef value, int f)
 {
-  StringRef value(valuestr);
   if(value.startsWith("url"))
-    return SvgAttr(name, idFromPaintUrl(valuestr).c_str());
+    return SvgAttr(name, idFromPaintUrl(value).c_str(), f);
   if(value == "currentColor")
-    return SvgAttr(name, SvgStyle::currentColor);
+    return SvgAttr(name, SvgStyle::currentColor, f);
   if(value == "none")
-    return SvgAttr(name, Color::NONE);
-  return SvgAttr(name, parseColor(value).color);
+    return SvgAttr(name, Color::NONE, f);
+  return SvgAttr(name, parseColor(value).color, f);
 }
 
-static real parseFontSize(const char* value)
+static real parseFontSize(const StringRef& value)
 {
   static constexpr SvgEnumVal fontSize[] = {{"xx-small", 0}, {"x-small", 1},
     {"small", 2}, {"medium", 3}, {"large", 4}, {"x-large", 4}, {"xx-large", 5}};
@@ -41,82 +41,84 @@ static real parseFontSize(const char* value)
   return idx >= 0 ? sizeTable[idx] : 0;
 }
 
-static SvgAttr processStdAttribute(SvgAttr::StdAttr stdattr, const char* value)
+// f is passed to SvgAttr so that name is looked up from stdattr instead of being interned; value need not be
+//  null terminated
+static SvgAttr processStdAttribute(SvgAttr::StdAttr stdattr, const StringRef& value, int f)
 {
   switch(stdattr) {
   case SvgAttr::COLOR:
-    return SvgAttr("color", parseColor(value).color);
+    return SvgAttr("color", parseColor(value).color, f);
   case SvgAttr::COMP_OP:
-    return SvgAttr("comp-op", parseEnum(value, SvgStyle::compOp));
+    return SvgAttr("comp-op", parseEnum(value, SvgStyle::compOp), f);
   case SvgAttr::DISPLAY:
-    return SvgAttr("display", StringRef(value) == "none" ? SvgNode::NoneMode : SvgNode::BlockMode);
+    return SvgAttr("display", value == "none" ? SvgNode::NoneMode : SvgNode::BlockMode, f);
   case SvgAttr::FILL:
-    return parsePaint("fill", value);
+    return parsePaint("fill", value, f);
   case SvgAttr::FILL_RULE:
-    return SvgAttr("fill-rule", parseEnum(value, SvgStyle::fillRule));
+    return SvgAttr("fill-rule", parseEnum(value, SvgStyle::fillRule), f);
   case SvgAttr::FILL_OPACITY:
-    return SvgAttr("fill-opacity", clamp(toReal(value, 1), 0.0, 1.0));
+    return SvgAttr("fill-opacity", clamp(toReal(value, 1), 0.0, 1.0), f);
   case SvgAttr::FONT_FAMILY:
     // Don't think there's much point resolving to SvgFont* unless we can also resolve regular fonts (note
     //  that font-family can be comma separated list of names, so we'd also have to preserve that somehow)
-    return SvgAttr("font-family", value);
+    return SvgAttr("font-family", value.data(), value.size(), f);
   case SvgAttr::FONT_SIZE:
-    return SvgAttr("font-size", parseFontSize(value));
+    return SvgAttr("font-size", parseFontSize(value), f);
   case SvgAttr::FONT_STYLE:
-    return SvgAttr("font-style", parseEnum(value, SvgStyle::fontStyle));
+    return SvgAttr("font-style", parseEnum(value, SvgStyle::fontStyle), f);
   case SvgAttr::FONT_VARIANT:
-    return SvgAttr("font-variant", parseEnum(value, SvgStyle::fontVariant));
+    return SvgAttr("font-variant", parseEnum(value, SvgStyle::fontVariant), f);
   case SvgAttr::FONT_WEIGHT:
   {
     real weightNum = toReal(value, NaN);
     if(!std::isnan(weightNum))
-      return SvgAttr("font-weight", int(weightNum));
+      return SvgAttr("font-weight", int(weightNum), f);
     else
-      return SvgAttr("font-weight", parseEnum(value, SvgStyle::fontWeight));
+      return SvgAttr("font-weight", parseEnum(value, SvgStyle::fontWeight), f);
   }
   case SvgAttr::OFFSET:
   {
     SvgLength len = parseLength(value, 0);
     real offset = len.units == SvgLength::PERCENT ? len.value/100 : len.value;
-    return SvgAttr("offset", clamp(offset, 0.0, 1.0));
+    return SvgAttr("offset", clamp(offset, 0.0, 1.0), f);
   }
   case SvgAttr::OPACITY:
-    return SvgAttr("opacity", clamp(toReal(value, 1), 0.0, 1.0));
+    return SvgAttr("opacity", clamp(toReal(value, 1), 0.0, 1.0), f);
   case SvgAttr::SHAPE_RENDERING:
-    return SvgAttr("shape-rendering", parseEnum(value, SvgStyle::shapeRendering, SvgStyle::Antialias));
+    return SvgAttr("shape-rendering", parseEnum(value, SvgStyle::shapeRendering, SvgStyle::Antialias), f);
   case SvgAttr::STOP_COLOR:
-    return parsePaint("stop-color", value);  // this will incorrectly accept URLs
+    return parsePaint("stop-color", value, f);  // this will incorrectly accept URLs
   case SvgAttr::STOP_OPACITY:
-    return SvgAttr("stop-opacity", clamp(toReal(value, 1), 0.0, 1.0));
+    return SvgAttr("stop-opacity", clamp(toReal(value, 1), 0.0, 1.0), f);
   case SvgAttr::STROKE:
-    return parsePaint("stroke", value);
+    return parsePaint("stroke", value, f);
   case SvgAttr::STROKE_DASHARRAY:
   {
     std::vector<real> dashes = parseNumbersList(value, 8);
     dashes.push_back(-1);  // terminate w/ negative number
     std::vector<float> dashesf(dashes.begin(), dashes.end());
-    return SvgAttr("stroke-dasharray", dashesf.data(), dashesf.size()*sizeof(float));
+    return SvgAttr("stroke-dasharray", dashesf.data(), dashesf.size()*sizeof(float), f);
   }
   case SvgAttr::STROKE_DASHOFFSET:
-    return SvgAttr("stroke-dashoffset", toReal(value, 0));
+    return SvgAttr("stroke-dashoffset", toReal(value, 0), f);
   case SvgAttr::STROKE_LINECAP:
-    return SvgAttr("stroke-linecap", parseEnum(value, SvgStyle::lineCap));
+    return SvgAttr("stroke-linecap", parseEnum(value, SvgStyle::lineCap), f);
   case SvgAttr::STROKE_LINEJOIN:
-    return SvgAttr("stroke-linejoin", parseEnum(value, SvgStyle::lineJoin));
+    return SvgAttr("stroke-linejoin", parseEnum(value, SvgStyle::lineJoin), f);
   case SvgAttr::STROKE_MITERLIMIT:
-    return SvgAttr("stroke-miterlimit", toReal(value, 0));
+    return SvgAttr("stroke-miterlimit", toReal(value, 0), f);
   case SvgAttr::STROKE_OPACITY:
-    return SvgAttr("stroke-opacity", clamp(toReal(value, 1), 0.0, 1.0));
+    return SvgAttr("stroke-opacity", clamp(toReal(value, 1), 0.0, 1.0), f);
   case SvgAttr::STROKE_WIDTH:
-    return SvgAttr("stroke-width", toReal(value, 0));
+    return SvgAttr("stroke-width", toReal(value, 0), f);
   case SvgAttr::TEXT_ANCHOR:
-    return SvgAttr("text-anchor", parseEnum(value, SvgStyle::textAnchor));
+    return SvgAttr("text-anchor", parseEnum(value, SvgStyle::textAnchor), f);
   case SvgAttr::VECTOR_EFFECT:
-    return SvgAttr("vector-effect", parseEnum(value, SvgStyle::vectorEffect));
+    return SvgAttr("vector-effect", parseEnum(value, SvgStyle::vectorEffect), f);
   case SvgAttr::VISIBILITY:
-    return SvgAttr("visibility", parseEnum(value, SvgStyle::visibility, 1));
+    return SvgAttr("visibility", parseEnum(value, SvgStyle::visibility, 1), f);
   case SvgAttr::LETTER_SPACING:
-    return SvgAttr("letter-spacing", toReal(value, 0));
+    return SvgAttr("letter-spacing", toReal(value, 0), f);
   default:
     return SvgAttr("", "");  // should never happen
   }
@@ -128,7 +130,7 @@ SvgAttr processAttribute(SvgAttr::Src src, const char* name, const char* value)
   SvgAttr::StdAttr stdattr = SvgAttr::nameToStdAttr(name);
   if(stdattr == SvgAttr::UNKNOWN)
     return SvgAttr(name, value, src);
-  return processStdAttribute(stdattr, value).setFlags(src | stdattr);
+  return processStdAttribute(stdattr, value, src | stdattr);
 }
 
 bool processAttribute(SvgNode* node, SvgAttr::Src src, const char* name, const char* value)
@@ -141,22 +143,43 @@ bool processAttribute(SvgNode* node, SvgAttr::Src src, const char* name, const c
   return true;
 }
 
+// style string is easy to parse - we don't need CSS parser!  Single pass over string w/o any copies, except
+//  for names of non-standard attributes not known to SvgAttr::internName()
 void processStyleString(SvgNode* node, const char* style)
 {
   if(!style || !style[0])
     return;
-  // style string is easy to parse - we don't need CSS parser!
-  std::vector<StringRef> cssAttrs = splitStringRef(style, ';', true);
-  node->attrs.reserve(node->attrs.size() + cssAttrs.size());
-  for(const StringRef& attr : cssAttrs) {
-    std::vector<StringRef> name_val = splitStringRef(attr, ':', false);
-    // this could be done much more efficiently - use splitStrInPlace then just strchr for ':'
-    // ... we'd also need trimInPlace
-    if(name_val.size() == 2)
-      processAttribute(node, SvgAttr::InlineStyleSrc,
-          name_val[0].trimmed().toString().c_str(), name_val[1].trimmed().toString().c_str());
-    else if(!attr.trimmed().isEmpty())
-      PLATFORM_LOG("Invalid CSS in style attribute\n");
+  size_t ndecls = 1;
+  for(const char* p = strchr(style, ';'); p; p = strchr(p + 1, ';'))
+    ++ndecls;
+  node->attrs.reserve(node->attrs.size() + ndecls);
+  const char* p = style;
+  while(*p) {
+    const char* start = p;
+    const char* colon = NULL;
+    bool valid = true;
+    for(; *p && *p != ';'; ++p) {
+      if(*p == ':') {
+        valid = !colon;  // "name:value:x" is invalid
+        colon = p;
+      }
+    }
+    StringRef decl(start, p - start);
+    if(*p) ++p;  // skip ';'
+    if(!colon || !valid) {
+      if(!decl.trimmed().isEmpty())
+        PLATFORM_LOG("Invalid CSS in style attribute\n");
+      continue;
+    }
+    StringRef name = StringRef(start, colon - start).trimmed();
+    StringRef value = StringRef(colon + 1, decl.end() - colon - 1).trimmed();
+    if(name.isEmpty() || value == "inherit")
+      continue;
+    SvgAttr::StdAttr stdattr = SvgAttr::nameToStdAttr(name.data(), name.size());
+    if(stdattr == SvgAttr::UNKNOWN)
+      node->setAttr(SvgAttr(name.toString().c_str(), value.toString().c_str(), SvgAttr::InlineStyleSrc));
+    else
+      node->setAttr(processStdAttribute(stdattr, value, SvgAttr::InlineStyleSrc | stdattr));
   }
 }
 
@@ -171,7 +194,19 @@ public:
   bool hasId(void* el, const char* id) const override { return strcmp(id, static_cast<SvgNode*>(el)->xmlId()) == 0; }
   const char* attribute(void* el, const char* name) const override { return NULL; }  // not supported (yet)
   void* parent(void* el) const override { return static_cast<SvgNode*>(el)->parent(); }
+  const char* tagName(void* el) const override { return SvgNode::nodeNames[static_cast<SvgNode*>(el)->type()]; }
+  const char* idName(void* el) const override { return static_cast<SvgNode*>(el)->xmlId(); }
+  const char* classNames(void* el) const override { return static_cast<SvgNode*>(el)->xmlClass(); }
   void parseDecl(const char* name, const char* value) override;
+  // CSS variables are resolved against ancestors, so descendants must be restyled if they change
+  bool affectsDescendants() const override
+  {
+    for(const SvgAttr& attr : attrs) {
+      if(attr.name()[0] == '-' && attr.name()[1] == '-')
+        return true;
+    }
+    return false;
+  }
 
   std::vector<SvgAttr> attrs;
 };
@@ -190,46 +225,272 @@ void SvgCssDecls::parseDecl(const char* name, const char* value)
 
 css_declarations* SvgCssStylesheet::createCssDecls() { return new SvgCssDecls; }
 
-void SvgCssStylesheet::applyStyle(SvgNode* node) const
+static void addToFilter(css_ancestor_filter& filter, const SvgNode* node)
 {
-  std::vector<SvgAttr> varAttrs;
+  const char* tag = SvgNode::nodeNames[node->type()];
+  filter.add(css_hash(0, tag, strlen(tag)));
+  if(node->xmlId()[0])
+    filter.add(css_hash('#', node->xmlId(), strlen(node->xmlId())));
+  const char* p = node->xmlClass();
+  for(StringRef word = nextWord(p); !word.isEmpty(); word = nextWord(p))
+    filter.add(css_hash('.', word.data(), word.size()));
+}
+
+// reused to avoid allocation
+static css_match_context& matchContext()
+{
+  static thread_local css_match_context ctx;
+  return ctx;
+}
+
+bool SvgCssStylesheet::matches(SvgNode* node) const
+{
+  css_match_context& ctx = matchContext();
+  ctx.reset(this, node);
   for(const css_rule& rule : rules()) {
-    if(rule.select(node)) {
-      for(const SvgAttr& attr : ((const SvgCssDecls*)rule.decls())->attrs) {
+    if(rule.select(ctx))
+      return true;
+  }
+  return false;
+}
+
+SvgCssStylesheet::StyleBlockRef SvgCssStylesheet::styleBlock(const std::vector<int>& matched) const
+{
+  size_t hash = matched.size();
+  for(int idx : matched)
+    hash = hash*31 + idx;
+  std::vector<StyleBlockRef>& bucket = m_blocks[hash];
+  for(const StyleBlockRef& block : bucket) {
+    if(block->rules == matched)
+      return block;
+  }
+  auto block = std::make_shared<StyleBlock>();
+  block->rules = matched;
+  // rules are in priority order and the first declaration of a name wins (see SvgNode::setAttrHelper), so
+  //  overridden declarations can be dropped here instead of being rejected by every node
+  for(int idx : matched) {
+    for(const SvgAttr& attr : ((const SvgCssDecls*)rules()[idx].decls())->attrs) {
+      auto sameName = [&](const SvgAttr& a){ return a.sameName(attr); };
+      if(std::none_of(block->attrs.begin(), block->attrs.end(), sameName)
+          && std::none_of(block->varAttrs.begin(), block->varAttrs.end(), sameName))
+      {
         if(attr.getFlags() & SvgAttr::Variable) {
-          SvgAttr* curr = const_cast<SvgAttr*>(node->getAttr(attr.name(), SvgAttr::CSSSrc));
-          if(!curr || curr->isStale())
-            varAttrs.push_back(attr);
-          // prevent replacement by a lower priority value
-          if(curr)
-            curr->setStale(false);
-          else
-            node->setAttr(attr);
+          block->varAttrs.push_back(attr);
+          block->varNames.push_back(attr.stringVal());
         }
         else
-          node->setAttr(attr);
+          block->attrs.push_back(attr);
+      }
+    }
+  }
+  bucket.push_back(block);
+  return block;
+}
+
+const SvgAttr* SvgVarScope::find(const char* name) const
+{
+  for(const SvgVarScope* scope = vars.empty() ? outer : this; scope; scope = scope->outer) {
+    auto it = scope->vars.find(name);
+    if(it != scope->vars.end())
+      return &it->second;
+  }
+  return NULL;
+}
+
+// returns variables visible to children of node; if any variable or the tree has changed, cached scope is
+//  checked against parent's and rebuilt only if variables set on node have changed or parent's scope was
+//  rebuilt (or node has moved)
+const std::shared_ptr<const SvgVarScope>& SvgCssStylesheet::varScope(const SvgNode* node)
+{
+  // nothing bumps epoch of a detached tree, so every cached scope must be checked against its parent's
+  const SvgDocument* root = node ? node->rootDocument() : NULL;
+  return varScope(node, root ? root->m_varScopeEpoch : 0, root != NULL);
+}
+
+const std::shared_ptr<const SvgVarScope>& SvgCssStylesheet::varScope(const SvgNode* node, unsigned int epoch,
+    bool useEpoch)
+{
+  static const std::shared_ptr<const SvgVarScope> noScope;
+  const SvgContainerNode* container = node ? node->asContainerNode() : NULL;
+  if(!container)
+    return noScope;
+  std::shared_ptr<const SvgVarScope>& scope = container->m_varScope;
+  if(scope && useEpoch && scope->epoch == epoch)
+    return scope;
+  const std::shared_ptr<const SvgVarScope>& parentScope = varScope(node->parent(), epoch, useEpoch);
+  if(scope && scope->version == container->m_varVersion && scope->parent == parentScope) {
+    scope->epoch = epoch;
+    return scope;
+  }
+
+  auto newScope = std::make_shared<SvgVarScope>();
+  for(const SvgAttr& attr : node->attrs) {
+    // node being styled is never an ancestor, so there will be no stale attrs
+    if(attr.src() == SvgAttr::CSSSrc && attr.name()[0] == '-' && attr.name()[1] == '-')
+      newScope->vars.insert_or_assign(attr.name(), attr);
+  }
+  newScope->parent = parentScope;
+  newScope->outer = !parentScope ? NULL : parentScope->vars.empty() ? parentScope->outer : parentScope.get();
+  newScope->version = container->m_varVersion;
+  newScope->epoch = epoch;
+  scope = std::move(newScope);
+  return scope;
+}
+
+// returns attr w/ value of variable parsed, or NULL if value is "inherit"; a given variable value usually
+//  appears in many nodes, so parsed attrs are cached
+const SvgAttr* SvgCssStylesheet::varValue(const SvgAttr& attr, const SvgAttr& value) const
+{
+  static constexpr size_t maxVarValues = 4096;  // in case variables are animated
+  std::string key(value.stringVal(), value.stringLen());
+  key.append(1, '\0').append(attr.name());
+  auto it = m_varValues.find(key);
+  if(it == m_varValues.end()) {
+    if(StringRef(value.stringVal()) == "inherit")
+      return NULL;
+    if(m_varValues.size() >= maxVarValues)
+      m_varValues.clear();
+    it = m_varValues.emplace(std::move(key), processAttribute(SvgAttr::CSSSrc, attr.name(), value.stringVal())).first;
+  }
+  return &it->second;
+}
+
+// returns computed style for node, or NULL if no rules can match; only reads node and its ancestors, so
+//  can be called from multiple threads
+SvgCssStylesheet::StyleBlockRef SvgCssStylesheet::matchStyle(const SvgNode* node) const
+{
+  const char* tag = SvgNode::nodeNames[node->type()];
+  std::vector<int> candidates;
+  std::string key;
+  if(candidate_rules(node->xmlId(), tag, node->xmlClass(), &candidates)) {
+    if(candidates.empty())
+      return NULL;
+    // id is left out of key unless a candidate tests it, since ids are usually unique
+    bool simple = true, usesId = false;
+    for(int idx : candidates) {
+      const css_rule& rule = rules()[idx];
+      simple = simple && rule.m_simple;
+      for(const css_attribute_selector& attr : rule.m_selector->m_right.m_attrs)
+        usesId = usesId || attr.attribute == "id";
+    }
+    if(simple) {
+      key.append(tag).append(1, '\0').append(node->xmlClass());
+      if(usesId)
+        key.append(1, '\0').append(node->xmlId());
+      std::lock_guard<std::mutex> lock(m_blocksMutex);
+      auto it = m_keyBlocks.find(key);
+      if(it != m_keyBlocks.end())
+        return it->second;
+    }
+  }
+  else {
+    candidates.resize(rules().size());
+    for(size_t ii = 0; ii < candidates.size(); ++ii)
+      candidates[ii] = ii;
+  }
+
+  std::vector<int> matched;
+  css_match_context& ctx = matchContext();
+  ctx.reset(this, const_cast<SvgNode*>(node));
+  css_ancestor_filter ancestors;
+  bool hasAncestors = false;
+  for(int idx : candidates) {
+    const css_rule& rule = rules()[idx];
+    if(!rule.m_ancestorHashes.empty()) {
+      if(!hasAncestors) {
+        for(const SvgNode* n = node->parent(); n; n = n->parent())
+          addToFilter(ancestors, n);
+        hasAncestors = true;
       }
+      if(!rule.may_match(ancestors))
+        continue;
     }
+    if(rule.select(ctx))
+      matched.push_back(idx);
+  }
+  std::lock_guard<std::mutex> lock(m_blocksMutex);
+  StyleBlockRef block = styleBlock(matched);
+  if(!key.empty())
+    m_keyBlocks.emplace(std::move(key), block);
+  return block;
+}
+
+// Only matching is done in parallel - applying style to a node can invalidate bounds of all its ancestors,
+//  and variables are resolved against ancestors' applied style, so applyStyle() must still be called in
+//  document order on one thread
+bool SvgCssStylesheet::matchSubtree(SvgNode* root, unsigned int nthreads, size_t minNodes)
+{
+  std::vector<const SvgNode*> nodes(1, root);
+  for(size_t ii = 0; ii < nodes.size(); ++ii) {
+    if(const SvgContainerNode* container = nodes[ii]->asContainerNode())
+      nodes.insert(nodes.end(), container->children().begin(), container->children().end());
+  }
+  if(nodes.size() < minNodes)
+    return false;
+
+  // several chunks per thread to even out load (cost of matching varies w/ depth and classes)
+  std::vector<StyleBlockRef> blocks(nodes.size());
+  size_t chunksize = std::max(nodes.size()/(16*std::max(nthreads, 1u)), size_t(256));
+  {
+    ThreadPool pool(nthreads);
+    std::vector< std::future<void> > results;
+    for(size_t begin = 0; begin < nodes.size(); begin += chunksize) {
+      size_t end = std::min(begin + chunksize, nodes.size());
+      results.push_back(pool.enqueue([this, &nodes, &blocks, begin, end](){
+        for(size_t ii = begin; ii < end; ++ii)
+          blocks[ii] = matchStyle(nodes[ii]);
+      }));
+    }
+    for(std::future<void>& result : results)
+      result.wait();
+  }
+  m_matched.reserve(m_matched.size() + nodes.size());
+  for(size_t ii = 0; ii < nodes.size(); ++ii)
+    m_matched[nodes[ii]] = std::move(blocks[ii]);
+  return true;
+}
+
+void SvgCssStylesheet::applyStyle(SvgNode* node) const
+{
+  auto it = m_matched.find(node);
+  StyleBlockRef block = it != m_matched.end() ? it->second : matchStyle(node);
+  if(!block)
+    return;
+
+  // names in block are unique, so order of attrs vs. varAttrs doesn't matter
+  node->setAttrs(block->attrs);
+  std::vector<size_t> unresolved;
+  for(size_t ii = 0; ii < block->varAttrs.size(); ++ii) {
+    const SvgAttr& attr = block->varAttrs[ii];
+    SvgAttr* curr = const_cast<SvgAttr*>(node->getAttr(attr.name(), SvgAttr::CSSSrc));
+    if(!curr || curr->isStale())
+      unresolved.push_back(ii);
+    // prevent replacement by a lower priority value
+    if(curr)
+      curr->setStale(false);
+    else
+      node->setAttr(attr);
   }
   // now resolve value of all variables - separate pass needed to get correct value for vars set and
-  //  referenced on same node; separate varAttrs list used instead of writing unresolved attrs to node
+  //  referenced on same node; separate unresolved list used instead of writing unresolved attrs to node
   //  (previous behavior) to prevent unnecessary dirtying of node
-  for(const SvgAttr& attr : varAttrs) {
+  for(size_t ii : unresolved) {
+    const SvgAttr& attr = block->varAttrs[ii];
+    const char* varname = block->varNames[ii].c_str();
     // allow replacement (or force removal if unresolved)
     SvgAttr* curr = const_cast<SvgAttr*>(node->getAttr(attr.name(), SvgAttr::CSSSrc));
     if(curr)
       curr->setStale(true);
-    // find closest ancestor with the variable set
-    for(SvgNode* n = node; n; n = n->parent()) {
-      const SvgAttr* valattr = n->getAttr(attr.stringVal(), SvgAttr::CSSSrc);
-      // !isStale() to prevent use of stale attribute from same node (no ancestors will have stale attrs)
-      if(valattr && !valattr->isStale()) {
-        // note that we use setAttribute so that the value of the variable is parsed
-        if(valattr->valueIs(SvgAttr::StringVal))  // should always be true
-          node->setAttribute(attr.name(), valattr->stringVal(), SvgAttr::CSSSrc);
-        break;
-      }
-    }
+    // variable set on node itself takes precedence; !isStale() to prevent use of stale attribute from same node
+    const SvgAttr* valattr = node->getAttr(varname, SvgAttr::CSSSrc);
+    if(valattr && valattr->isStale())
+      valattr = NULL;
+    const SvgVarScope* scope = valattr ? NULL : varScope(node->parent()).get();
+    if(scope)
+      valattr = scope->find(varname);
+    const SvgAttr* value = valattr && valattr->valueIs(SvgAttr::StringVal) ? varValue(attr, *valattr) : NULL;
+    if(value)
+      node->setAttr(*value);
   }
 }
 
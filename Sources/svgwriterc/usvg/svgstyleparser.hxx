@@ -3,13 +3,62 @@
 #include "svgnode.hxx"
 
 #ifndef NO_CSS
+#include <mutex>
 #include "cssparser.hxx"
 
+// CSS variables set on a container node, linked to those set on ancestors (see SvgCssStylesheet::varScope())
+struct SvgVarScope
+{
+  std::unordered_map<std::string, SvgAttr> vars;  // variable names are never interned
+  std::shared_ptr<const SvgVarScope> parent;  // scope this was built from
+  const SvgVarScope* outer;  // closest ancestor scope w/ any variables set (kept alive by parent)
+  unsigned int version;  // SvgContainerNode::m_varVersion when built
+  mutable unsigned int epoch;  // SvgDocument::m_varScopeEpoch of root document when last found valid
+
+  const SvgAttr* find(const char* name) const;
+};
+
 class SvgCssStylesheet : public css_stylesheet
 {
 public:
   css_declarations* createCssDecls() override;
   void applyStyle(SvgNode* node) const;
+  // match rules for all nodes in subtree on multiple threads, to be used by applyStyle() (e.g. from restyle())
+  //  until clearMatched(); returns false if subtree has fewer than minNodes nodes.  Matching depends only on
+  //  ids, classes, and tree structure, so it must be done before any of those change
+  bool matchSubtree(SvgNode* root, unsigned int nthreads, size_t minNodes = 0);
+  void clearMatched() { m_matched.clear(); }
+  // true if node is matched by selector of any rule (used by SvgContainerNode::select())
+  bool matches(SvgNode* node) const;
+
+private:
+  // computed style: declarations of a set of matched rules merged in priority order; immutable and shared by all
+  //  nodes matching the same rules (e.g. siblings w/ the same class)
+  struct StyleBlock
+  {
+    std::vector<int> rules;
+    std::vector<SvgAttr> attrs;
+    std::vector<SvgAttr> varAttrs;  // values referencing CSS variables, which must be resolved per node
+    std::vector<std::string> varNames;  // names of variables referenced by varAttrs
+  };
+  typedef std::shared_ptr<const StyleBlock> StyleBlockRef;
+
+  mutable std::unordered_map<size_t, std::vector<StyleBlockRef>> m_blocks;  // hash of rule indices -> blocks
+  // tag, id, and classes -> block, used if all candidate rules are simple so selector matching can be skipped
+  mutable std::unordered_map<std::string, StyleBlockRef> m_keyBlocks;
+  mutable std::mutex m_blocksMutex;  // for m_blocks and m_keyBlocks, since matchSubtree() is multithreaded
+  std::unordered_map<const SvgNode*, StyleBlockRef> m_matched;  // from matchSubtree()
+
+  // parsed values of variable references, keyed by value + '\0' + attribute name
+  mutable std::unordered_map<std::string, SvgAttr> m_varValues;
+
+  StyleBlockRef matchStyle(const SvgNode* node) const;
+  StyleBlockRef styleBlock(const std::vector<int>& matched) const;
+  const SvgAttr* varValue(const SvgAttr& attr, const SvgAttr& value) const;
+  static const std::shared_ptr<const SvgVarScope>& varScope(const SvgNode* node);
+  static const std::shared_ptr<const SvgVarScope>& varScope(const SvgNode* node, unsigned int epoch,
+      bool useEpoch);
+  void rules_indexed() override { m_blocks.clear();  m_keyBlocks.clear();  m_matched.clear(); }
 };
 #endif
 
@@ -17,13 +66,21 @@ std::string idFromPaintUrl(StringRef id);
 void processStyleString(SvgNode* node, const char* style);
 bool processAttribute(SvgNode* node, SvgAttr::Src src, const char* name, const char* value);
 
-struct SvgEnumVal { const char* str; int val; };
+// hash is computed at compile time for constexpr tables so parseEnum only needs to compare strings on a hash match
+struct SvgEnumVal
+{
+  const char* str;
+  int val;
+  uint32_t hash;
+  constexpr SvgEnumVal(const char* s, int v) : str(s), val(v), hash(constHash(s)) {}
+};
 
 template<int N>
 int parseEnum(const StringRef& value, const SvgEnumVal (&enumvals)[N], int dflt = INT_MIN)
 {
+  uint32_t hash = constHash(value.data(), value.size());
   for(const SvgEnumVal& enumval : enumvals) {
-    if(enumval.str == value)
+    if(enumval.hash == hash && enumval.str == value)
       return enumval.val;
   }
   return dflt;
@@ -63,13 +63,13 @@ char* SvgWriter::serializeTransform(char* buff, const Transform2D& tf, int prec)
     else if(tf.isTranslate()) {
         const char* src = "translate(";
         while(*src) *buff++ = *src++;
-        buff += realToStr(buff, tf.xoffset(), prec);  *buff++ = ',';  buff += realToStr(buff, tf.yoffset(), prec);
+        buff += realPairToStr(buff, tf.xoffset(), tf.yoffset(), prec, ',');
         *buff++ = ')';  *buff++ = '\0';
     }
     else {
         const char* src = "matrix(";
         while(*src) *buff++ = *src++;
-        buff += writeNumbersList(buff, {tf.m[0], tf.m[1], tf.m[2], tf.m[3], tf.m[4], tf.m[5]});
+        buff += writeNumbersList(buff, {tf.m[0], tf.m[1], tf.m[2], tf.m[3], tf.m[4], tf.m[5]}, ' ', prec);
         *buff++ = ')';  *buff++ = '\0';
     }
     return buff0;
@@ -290,30 +290,37 @@ void SvgWriter::_serialize(SvgImage* node)
     if(m_bounds.height() > 0) xml.writeAttribute("height", m_bounds.height());
     //xml.writeAttribute("preserveAspectRatio", "none");
 
-    // m_linkStr will be empty iff image successfully loaded from inline base64
+    // m_linkStr will be empty iff image is inline base64
     if(node->m_linkStr.empty()) {
-        Image cropped(0, 0);
-        bool crop = node->srcRect.isValid() && node->srcRect != SVGRect::wh(node->m_image.width, node->m_image.height);
-        if(crop)
-            cropped = node->m_image.cropped(node->srcRect);
-        const Image& img = crop ? cropped : node->m_image;
-
+        int imgw = node->imageWidth(), imgh = node->imageHeight();
+        bool crop = node->srcRect.isValid() && node->srcRect != SVGRect::wh(imgw, imgh);
         Transform2D tf = node->totalTransform();
         SVGRect tf_bounds = tf.mapRect(node->viewport());
         int scaledw = int(saveImageScaled*tf_bounds.width() + 0.5);
         int scaledh = int(saveImageScaled*tf_bounds.height() + 0.5);
         // shrink image to save space if sufficient size change (and new size is not tiny)
         bool scaleimg = saveImageScaled > 0 && tf_bounds.width() > 10 && tf_bounds.height() > 10
-        && (scaledw < 0.75*img.width || scaledh < 0.75*img.height);
+        && (scaledw < 0.75*imgw || scaledh < 0.75*imgh);
+        // if image is unmodified (or couldn't be decoded), write original data: URI w/o decoding
+        if(!node->m_dataUri.empty() && ((!crop && !scaleimg) || imgw <= 0)) {
+            xml.writeAttribute("xlink:href", node->m_dataUri.c_str());
+            xml.writeEndElement();
+            return;
+        }
+
+        Image cropped(0, 0);
+        if(crop)
+            cropped = node->constImage().cropped(node->srcRect);
+        const Image& img = crop ? cropped : node->constImage();
         // compress image
         Image::Encoding fmt = img.encoding == Image::JPEG && !img.hasTransparency() ? Image::JPEG : Image::PNG;
         auto buff = scaleimg ? img.scaled(scaledw, scaledh).encode(fmt) : img.encode(fmt);
 
         std::string prefix = std::string("data:image/") + (fmt == Image::JPEG ? "jpeg" : "png") + ";base64,";
-        size_t base64len = base64_enclen(buff.size()) + prefix.size() + 1;  // account for \0 terminator
+        size_t base64len = base64_enclen(buff->size()) + prefix.size() + 1;  // account for \0 terminator
         char* base64 = new char[base64len];
         strcpy(base64, prefix.c_str());
-        base64_encode(buff.data(), buff.size(), base64 + prefix.size());
+        base64_encode(buff->data(), buff->size(), base64 + prefix.size());
         base64[base64len - 1] = '\0';
         xml.writeAttribute("xlink:href", base64);
         delete[] base64;
@@ -326,15 +333,16 @@ void SvgWriter::_serialize(SvgImage* node)
 
 static inline char* writePathXY(char* ts, real x, real y, int prec)
 {
-    ts += realToStr(ts, x, prec);  *ts++ = ' ';  ts += realToStr(ts, y, prec);
-    return ts;
+    return ts + realPairToStr(ts, x, y, prec);
 }
 
-static size_t maxPathDataLen(const Path2D& m_path)
+static size_t maxPathDataLen(const Path2D& m_path, int prec)
 {
+    // shortest round trip (prec < 0) can need up to 24 chars per coord, e.g., -1.2345678901234567e-100
     static constexpr int MAX_CHARS_PER_POINT = 32;
+    static constexpr int MAX_CHARS_PER_POINT_EXACT = 52;
     static constexpr int MIN_PATHD_STR_LEN = 256;
-    return m_path.size()*MAX_CHARS_PER_POINT + MIN_PATHD_STR_LEN;
+    return m_path.size()*(prec < 0 ? MAX_CHARS_PER_POINT_EXACT : MAX_CHARS_PER_POINT) + MIN_PATHD_STR_LEN;
 }
 
 static const char* serializePathData(char* buff, const Path2D& m_path, int prec, bool relative = true)
@@ -386,7 +394,7 @@ static const char* serializePathData(char* buff, const Path2D& m_path, int prec,
             else if(cmd == Path2D::CubicTo) ncmdpts = 3;
             else if(cmd == Path2D::QuadTo) ncmdpts = 2;
         }
-        const SVGPoint& pt = m_path.points[i];
+        SVGPoint pt = m_path.point(i);
         ts = writePathXY(ts, pt.x - prevpt.x, pt.y - prevpt.y, prec);
         if(relative && --ncmdpts == 0)
             prevpt = pt;
@@ -398,7 +406,7 @@ static const char* serializePathData(char* buff, const Path2D& m_path, int prec,
 
 void SvgWriter::_serialize(SvgPath* node)
 {
-    const Path2D& m_path = node->m_path;
+    const Path2D& m_path = node->constPath();
     if(node->m_pathType == SvgNode::LINE) {
         xml.writeStartElement("line");
         serializeNodeAttr(node);
@@ -424,8 +432,8 @@ void SvgWriter::_serialize(SvgPath* node)
 
     xml.writeStartElement("path");
     serializeNodeAttr(node);
-    char* buff = xml.getTemp(maxPathDataLen(node->m_path));
-    xml.writeAttribute("d", serializePathData(buff, node->m_path, xml.defaultFloatPrecision, pathDataRel));
+    char* buff = xml.getTemp(maxPathDataLen(node->constPath(), xml.defaultFloatPrecision));
+    xml.writeAttribute("d", serializePathData(buff, node->constPath(), xml.defaultFloatPrecision, pathDataRel));
     xml.writeEndElement();
 }
 
@@ -508,7 +516,7 @@ void SvgWriter::_serialize(SvgFont* node)
         if(!glyph->m_unicode.empty()) xml.writeAttribute("unicode", glyph->m_unicode);
         if(glyph->m_horizAdvX >= 0) xml.writeAttribute("horiz-adv-x", glyph->m_horizAdvX);
         serializeNodeAttr(glyph);
-        char* buff = xml.getTemp(maxPathDataLen(glyph->m_path));
+        char* buff = xml.getTemp(maxPathDataLen(glyph->m_path, xml.defaultFloatPrecision));
         xml.writeAttribute("d", serializePathData(buff, glyph->m_path, xml.defaultFloatPrecision, pathDataRel));
         xml.writeEndElement();
     }
@@ -16,7 +16,7 @@ public:
   static bool DEBUG_CSS_STYLE;
   static bool DEFAULT_PATH_DATA_REL;
   static float DEFAULT_SAVE_IMAGE_SCALED;
-  static int SVG_FLOAT_PRECISION;
+  static int SVG_FLOAT_PRECISION;  // < 0 to write shortest string that parses back exactly
 
   static char* serializeColor(char* buff, const Color& color);
   // TODO: make these non-static and use xml.defaultFloatPrecision instead
@@ -41,7 +41,7 @@ class XmlStreamWriter
   std::vector<char> temp;
 
 public:
-  int defaultFloatPrecision = 3;
+  int defaultFloatPrecision = 3;  // < 0 for shortest round trip
 
   XmlStreamWriter() : temp(1024) { node = doc; }
 
@@ -183,12 +183,16 @@ public:
   const char* name() { return nodes.back().name(); }
   const char* text() { return nodes.back().value(); }
   XmlStreamAttributes attributes() { return XmlStreamAttributes(nodes.back()); }
+  const pugi::xml_node& node() const { return nodes.back(); }
+
+  // skip children of current node - next call to readNext() will advance to next sibling (note that no
+  //  EndElement is reported for the current node)
+  void skipNode() { starting = false; }
 
   // this can be used to store unrecognized nodes
   XmlFragment* readNodeAsFragment()
   {
-    // this will cause next call to readNext() to advance to next sibling of current node
-    starting = false;
+    skipNode();
     return nodes.empty() ? new XmlFragment(pugi::xml_node()) : new XmlFragment(nodes.back());
   }
 
@@ -206,7 +210,8 @@ public:
       starting = false;
     else {
       // this should handle both node_element types and other node types with never have sibilings
-      pugi::xml_node next = nodes.back().next_sibling();
+      // don't wander off to siblings of topNode when reading a subtree
+      pugi::xml_node next = nodes.size() > 1 ? nodes.back().next_sibling() : pugi::xml_node();
       if(next) {
         nodes.back() = next;
         starting = true;